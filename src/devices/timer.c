@@ -20,6 +20,39 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Hierarchical timer wheel holding the armed timeouts.
+
+   Level 0 has one slot per tick for the next WHEEL_SIZE ticks.
+   Each slot of level L covers WHEEL_SIZE**L ticks, further in
+   the future.  Every WHEEL_SIZE**L ticks, the next slot of level
+   L is "cascaded": its timeouts are rearmed, which moves them to
+   lower levels.  A timeout thus moves at most WHEEL_LEVELS - 1
+   times before it fires, and arming or canceling one is a list
+   insertion or removal.  Timeouts further away than the wheel's
+   span wait in the top level and are rearmed until they fit.
+
+   Within a slot, timeouts are kept in the order they were armed
+   or cascaded. */
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS 4
+#define WHEEL_SPAN ((int64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+static struct list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+
+/* PIT cycles per timer tick. */
+#define TICK_CYCLES ((PIT_HZ + TIMER_FREQ / 2) / TIMER_FREQ)
+
+/* Tickless idle.  While nothing runs and no timeout is due, the
+   idle thread replaces the periodic tick by a one-shot countdown
+   of up to 65535 PIT cycles (5 ticks at 100 Hz).  When it ends,
+   or when some other interrupt wakes the CPU early, the skipped
+   ticks are caught up one by one, so timeouts, statistics and
+   the scheduler see every tick. */
+static int oneshot_ticks;       /* Ticks the countdown spans, or 0. */
+static uint16_t oneshot_count;  /* PIT cycles the countdown spans. */
+static uint16_t oneshot_first;  /* PIT cycles to its first tick. */
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
@@ -29,12 +62,22 @@ static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static void wake_up (void *thread);
+static void wheel_add (struct timeout *);
+static void wheel_advance (void);
+static int wheel_idle_ticks (int max);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  int level, slot;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    for (slot = 0; slot < WHEEL_SIZE; slot++)
+      list_init (&wheel[level][slot]);
+
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
@@ -85,15 +128,198 @@ timer_elapsed (int64_t then)
 }
 
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
-   be turned on. */
+   be turned on.
+
+   The thread blocks until a timeout wakes it, so it does not
+   compete for the CPU meanwhile. */
 void
 timer_sleep (int64_t ticks) 
 {
-  int64_t start = timer_ticks ();
+  struct timeout timeout;
+  enum intr_level old_level;
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  if (ticks <= 0)
+    return;
+
+  timeout_init (&timeout, wake_up, thread_current ());
+  old_level = intr_disable ();
+  timeout_arm (&timeout, timer_ticks () + ticks);
+  thread_block ();
+  intr_set_level (old_level);
+}
+
+/* Timeout function of timer_sleep(). */
+static void
+wake_up (void *thread) 
+{
+  thread_unblock (thread);
+}
+
+/* Initializes timeout T to call FUNC(AUX) once armed. */
+void
+timeout_init (struct timeout *t, void (*func) (void *aux), void *aux) 
+{
+  ASSERT (t != NULL && func != NULL);
+
+  t->func = func;
+  t->aux = aux;
+  t->armed = false;
+}
+
+/* Arms timeout T to fire at tick EXPIRES, or at the next tick if
+   EXPIRES has passed.  T must not be armed already. */
+void
+timeout_arm (struct timeout *t, int64_t expires) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  ASSERT (!t->armed);
+  t->expires = expires > ticks ? expires : ticks + 1;
+  t->armed = true;
+  wheel_add (t);
+  intr_set_level (old_level);
+}
+
+/* Disarms timeout T, if it is armed. */
+void
+timeout_cancel (struct timeout *t) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (t->armed)
+    {
+      list_remove (&t->elem);
+      t->armed = false;
+    }
+  intr_set_level (old_level);
+}
+
+/* Puts armed timeout T in the wheel slot for its expiry time,
+   which must not have passed. */
+static void
+wheel_add (struct timeout *t) 
+{
+  int64_t when = t->expires;
+  int level;
+
+  ASSERT (when >= ticks);
+  if (when - ticks >= WHEEL_SPAN)
+    when = ticks + WHEEL_SPAN - 1;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (when - ticks < (int64_t) 1 << (WHEEL_BITS * (level + 1)))
+      break;
+  list_push_back (&wheel[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK],
+                  &t->elem);
+}
+
+/* Fires the timeouts due at the current tick, after cascading the
+   higher-level slots whose time has come. */
+static void
+wheel_advance (void) 
+{
+  struct list *slot;
+  int level;
+
+  for (level = 1; level < WHEEL_LEVELS; level++) 
+    {
+      if ((ticks & (((int64_t) 1 << (WHEEL_BITS * level)) - 1)) != 0)
+        break;
+      slot = &wheel[level][(ticks >> (WHEEL_BITS * level)) & WHEEL_MASK];
+      while (!list_empty (slot))
+        wheel_add (list_entry (list_pop_front (slot), struct timeout, elem));
+    }
+
+  slot = &wheel[0][ticks & WHEEL_MASK];
+  while (!list_empty (slot)) 
+    {
+      struct timeout *t = list_entry (list_pop_front (slot),
+                                      struct timeout, elem);
+      ASSERT (t->expires == ticks);
+      t->armed = false;
+      t->func (t->aux);
+    }
+}
+
+/* Returns the number of ticks, from 1 to MAX, until the next tick
+   at which the wheel has work to do: a timeout to fire, or a
+   cascade, which might bring one due. */
+static int
+wheel_idle_ticks (int max) 
+{
+  int64_t t;
+
+  for (t = ticks + 1; t < ticks + max; t++)
+    if (!list_empty (&wheel[0][t & WHEEL_MASK]) || (t & WHEEL_MASK) == 0)
+      break;
+  return t - ticks;
+}
+
+/* Called by the idle thread, with interrupts off, just before it
+   halts.  If no timeout is due at the next tick, replaces the
+   periodic timer interrupt by a countdown to the next tick at
+   which one is due, so the CPU is not woken in between. */
+void
+timer_idle_enter (void) 
+{
+  uint16_t left;
+  bool output;
+  int max, idle_ticks;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (oneshot_ticks != 0)
+    return;
+
+  /* Stay in phase with the periodic tick: the countdown's first
+     tick comes when the current period would have ended. */
+  left = pit_read_channel (0, &output);
+  if (left == 0 || left > TICK_CYCLES)
+    return;
+  max = (UINT16_MAX - left) / TICK_CYCLES + 1;
+  idle_ticks = wheel_idle_ticks (max);
+  if (idle_ticks <= 1)
+    return;
+
+  oneshot_ticks = idle_ticks;
+  oneshot_first = left;
+  oneshot_count = left + (idle_ticks - 1) * TICK_CYCLES;
+  pit_start_countdown (0, oneshot_count);
+}
+
+/* Called when the CPU leaves the idle thread: by the idle thread
+   once it has been woken up, and by the scheduler when an
+   interrupt handler switched straight from idle to a thread it
+   woke.  If an interrupt other than the timer's woke the CPU
+   during a countdown, which would delay every tick until the
+   countdown ends, cuts the countdown short at the next tick
+   boundary.  A countdown already cut short spans at most one
+   period and is left alone. */
+void
+timer_idle_exit (void) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  if (oneshot_ticks > 1 && oneshot_count > TICK_CYCLES) 
+    {
+      bool done;
+      uint16_t left = pit_read_channel (0, &done);
+
+      /* If the countdown has run out, its interrupt is pending. */
+      if (!done) 
+        {
+          int elapsed = oneshot_count - left;
+          int passed = elapsed < oneshot_first
+                       ? 0 : (elapsed - oneshot_first) / TICK_CYCLES + 1;
+          int next = oneshot_first + passed * TICK_CYCLES - elapsed;
+          if (passed + 1 < oneshot_ticks) 
+            {
+              oneshot_ticks = passed + 1;
+              oneshot_first = oneshot_count = next;
+              pit_start_countdown (0, next);
+            }
+        }
+    }
+  intr_set_level (old_level);
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -166,12 +392,33 @@ timer_print_stats (void)
   printf ("Timer: %"PRId64" ticks\n", timer_ticks ());
 }
 
-/* Timer interrupt handler. */
+/* Timer interrupt handler.  Fires the timeouts that are due.
+   At the end of a tickless idle countdown, also catches up with
+   the ticks it skipped and restarts the periodic interrupt. */
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-  ticks++;
-  thread_tick ();
+  int n = 1;
+
+  if (oneshot_ticks != 0) 
+    {
+      /* If the countdown is still running, this is a periodic
+         tick that was already pending when it was started. */
+      bool done;
+      pit_read_channel (0, &done);
+      if (done) 
+        {
+          n = oneshot_ticks;
+          oneshot_ticks = 0;
+          pit_configure_channel (0, 2, TIMER_FREQ);
+        }
+    }
+  while (n-- > 0) 
+    {
+      ticks++;
+      wheel_advance ();
+      thread_tick ();
+    }
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
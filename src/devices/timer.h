@@ -1,7 +1,9 @@
 #ifndef DEVICES_TIMER_H
 #define DEVICES_TIMER_H
 
+#include <list.h>
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -19,6 +21,26 @@ void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
 
+/* Timeouts.  FUNC(AUX) is called from the timer interrupt, with
+   interrupts off, at the tick the timeout expires.  Arming and
+   canceling take constant time. */
+struct timeout
+  {
+    int64_t expires;            /* Tick at which to call FUNC. */
+    void (*func) (void *aux);   /* Called on expiry. */
+    void *aux;                  /* Argument to FUNC. */
+    bool armed;                 /* In the timer wheel? */
+    struct list_elem elem;      /* Element in a timer wheel slot. */
+  };
+
+void timeout_init (struct timeout *, void (*func) (void *aux), void *aux);
+void timeout_arm (struct timeout *, int64_t expires);
+void timeout_cancel (struct timeout *);
+
+/* Tickless idle, for the idle thread. */
+void timer_idle_enter (void);
+void timer_idle_exit (void);
+
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
 void timer_udelay (int64_t microseconds);
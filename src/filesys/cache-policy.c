@@ -0,0 +1,209 @@
+#include "filesys/cache-policy.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include "threads/malloc.h"
+
+// ----------------------------------------------------------------------
+// CLOCK: second chance over a ring of entries.
+// The front of the list is the clock hand.
+
+static struct list clock_ring;
+
+static void clock_init(void)
+{
+    list_init(&clock_ring);
+}
+
+static void clock_insert(Cache *c)
+{
+    c->second_chance = true;
+    list_push_back(&clock_ring, &c->policy_elem);
+}
+
+static void clock_access(Cache *c)
+{
+    c->second_chance = true;
+}
+
+static void clock_remove(Cache *c, bool evicted UNUSED)
+{
+    list_remove(&c->policy_elem);
+}
+
+static Cache *clock_victim(void)
+{
+    size_t n = 2 * list_size(&clock_ring);
+    for(size_t k = 0; k < n; k++) {
+        Cache *c = list_entry(list_pop_front(&clock_ring), Cache, policy_elem);
+        list_push_back(&clock_ring, &c->policy_elem);
+        if (c->second_chance) {
+            c->second_chance = false;
+        }
+        else if (cache_try_lock(c)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+const struct cache_policy cache_policy_clock = {
+    "clock", clock_init, clock_insert, clock_access, clock_remove, clock_victim
+};
+
+// ----------------------------------------------------------------------
+// 2Q (Johnson and Shasha, VLDB '94), full version.
+// New sectors enter the FIFO A1in.  A sector evicted from A1in is
+// remembered in the ghost queue A1out; if it is missed again while
+// remembered it goes to the LRU queue Am.  A sequential scan therefore
+// only ever cycles through A1in and cannot flush the hot sectors in Am.
+
+#define TWOQ_IN_RATIO 25 // Percent of the cache given to A1in
+#define TWOQ_OUT_RATIO 50 // Ghost entries, in percent of the cache
+
+enum { TWOQ_A1IN, TWOQ_AM };
+
+// A sector recently evicted from A1in.
+struct twoq_ghost
+{
+    block_sector_t sector_id;
+    struct hash_elem hash_elem; // Element in twoq_ghosts, while remembered
+    struct list_elem list_elem; // Element in twoq_a1out or twoq_ghost_free
+};
+
+static struct list twoq_a1in; // FIFO, oldest first
+static struct list twoq_am; // LRU, least recent first
+static size_t twoq_a1in_cnt;
+static size_t twoq_kin; // Target size of A1in
+
+static struct list twoq_a1out; // Ghosts, oldest first
+static struct list twoq_ghost_free; // Unused ghosts
+static struct hash twoq_ghosts; // Ghosts in A1out, keyed by sector
+
+static unsigned twoq_ghost_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int(hash_entry(e, struct twoq_ghost, hash_elem)->sector_id);
+}
+
+static bool twoq_ghost_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    return hash_entry(a, struct twoq_ghost, hash_elem)->sector_id
+           < hash_entry(b, struct twoq_ghost, hash_elem)->sector_id;
+}
+
+static void twoq_init(void)
+{
+    size_t kout = cache_size * TWOQ_OUT_RATIO / 100;
+    struct twoq_ghost *ghosts = malloc(kout * sizeof *ghosts);
+
+    list_init(&twoq_a1in);
+    list_init(&twoq_am);
+    list_init(&twoq_a1out);
+    list_init(&twoq_ghost_free);
+    twoq_a1in_cnt = 0;
+    twoq_kin = cache_size * TWOQ_IN_RATIO / 100;
+    if (ghosts == NULL || !hash_init(&twoq_ghosts, twoq_ghost_hash, twoq_ghost_less, NULL))
+        PANIC("2Q: cannot allocate the ghost queue");
+    for(size_t i = 0; i < kout; i++) {
+        list_push_back(&twoq_ghost_free, &ghosts[i].list_elem);
+    }
+}
+
+// Forget ghost <g>.
+static void twoq_ghost_drop(struct twoq_ghost *g)
+{
+    hash_delete(&twoq_ghosts, &g->hash_elem);
+    list_remove(&g->list_elem);
+    list_push_back(&twoq_ghost_free, &g->list_elem);
+}
+
+// Remember that <sector> was evicted from A1in, forgetting the oldest
+// ghost if A1out is full.
+static void twoq_ghost_add(block_sector_t sector)
+{
+    struct twoq_ghost *g;
+    if (list_empty(&twoq_ghost_free)) {
+        if (list_empty(&twoq_a1out)) {
+            return;
+        }
+        twoq_ghost_drop(list_entry(list_front(&twoq_a1out), struct twoq_ghost, list_elem));
+    }
+    g = list_entry(list_pop_front(&twoq_ghost_free), struct twoq_ghost, list_elem);
+    g->sector_id = sector;
+    if (hash_insert(&twoq_ghosts, &g->hash_elem) != NULL) {
+        list_push_back(&twoq_ghost_free, &g->list_elem); // Already remembered.
+        return;
+    }
+    list_push_back(&twoq_a1out, &g->list_elem);
+}
+
+static void twoq_insert(Cache *c)
+{
+    struct twoq_ghost key;
+    struct hash_elem *e;
+
+    key.sector_id = c->sector_id;
+    e = hash_find(&twoq_ghosts, &key.hash_elem);
+    if (e != NULL) {
+        twoq_ghost_drop(hash_entry(e, struct twoq_ghost, hash_elem));
+        c->policy_queue = TWOQ_AM;
+        list_push_back(&twoq_am, &c->policy_elem);
+    }
+    else {
+        c->policy_queue = TWOQ_A1IN;
+        list_push_back(&twoq_a1in, &c->policy_elem);
+        twoq_a1in_cnt++;
+    }
+}
+
+static void twoq_access(Cache *c)
+{
+    if (c->policy_queue == TWOQ_AM) {
+        list_remove(&c->policy_elem);
+        list_push_back(&twoq_am, &c->policy_elem);
+    }
+}
+
+// Only a sector evicted from A1in is remembered; one promoted to the
+// metadata list was not pushed out, and must not skip A1in next time.
+static void twoq_remove(Cache *c, bool evicted)
+{
+    list_remove(&c->policy_elem);
+    if (c->policy_queue == TWOQ_A1IN) {
+        twoq_a1in_cnt--;
+        if (evicted) {
+            twoq_ghost_add(c->sector_id);
+        }
+    }
+}
+
+// Return the first entry of <queue> that can be locked, or NULL.
+static Cache *twoq_first_unlocked(struct list *queue)
+{
+    for(struct list_elem *e = list_begin(queue); e != list_end(queue); e = list_next(e)) {
+        Cache *c = list_entry(e, Cache, policy_elem);
+        if (cache_try_lock(c)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+static Cache *twoq_victim(void)
+{
+    Cache *c = NULL;
+    if (twoq_a1in_cnt > twoq_kin || list_empty(&twoq_am)) {
+        c = twoq_first_unlocked(&twoq_a1in);
+    }
+    if (c == NULL) {
+        c = twoq_first_unlocked(&twoq_am);
+    }
+    if (c == NULL) {
+        c = twoq_first_unlocked(&twoq_a1in);
+    }
+    return c;
+}
+
+const struct cache_policy cache_policy_2q = {
+    "2q", twoq_init, twoq_insert, twoq_access, twoq_remove, twoq_victim
+};
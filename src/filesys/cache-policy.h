@@ -0,0 +1,24 @@
+#pragma once
+#include <stdbool.h>
+#include "filesys/cache.h"
+
+// Replacement policy of the sector cache.
+// Every hook is called with cache_lock held.  Metadata entries are kept
+// on a separate list by cache.c and are never handed to the policy.
+struct cache_policy
+{
+    const char *name; // Name accepted by "-cache-policy"
+    void (*init)(void); // Set up the policy's lists for cache_size entries
+    void (*insert)(Cache *); // A sector was just brought into <c>
+    void (*access)(Cache *); // Cache hit on <c>
+    void (*remove)(Cache *, bool evicted); // <c> leaves the policy, evicted or promoted
+    Cache *(*victim)(void); // Pick an entry to evict, see cache_try_lock()
+};
+
+extern const struct cache_policy cache_policy_clock;
+extern const struct cache_policy cache_policy_2q;
+
+// Lock <c> for eviction if it is neither in flight nor locked, and is
+// clean while cache_evict() is looking for clean victims.
+// Policies return victims locked this way, still tracked by the policy.
+bool cache_try_lock(Cache *);
@@ -1,84 +1,380 @@
 #include "cache.h"
+#include <stdio.h>
+#include "cache-policy.h"
 #include "devices/block.h"
 #include "list.h"
 #include "threads/synch.h"
 #include "devices/timer.h"
 #include "filesys.h"
 #include "threads/thread.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include "string.h"
+#include <round.h>
 
-static Cache cache[CACHE_SIZE];
+size_t cache_size = CACHE_DEFAULT_SIZE;
+static Cache *cache; // Array of cache_size entries from the kernel pool
+static struct hash cache_index; // Cache entries in use, keyed by sector id
+static struct list cache_free_list; // Cache entries not holding any sector
+static struct list cache_dirty_list; // Dirty entries, oldest first
+static size_t cache_dirty_cnt; // Number of entries in cache_dirty_list
+static size_t cache_flushing_cnt; // Number of entries being written back
+static size_t cache_dirty_background; // Dirty count at which age is ignored
+static size_t cache_dirty_limit; // Dirty count at which writers are throttled
+
+// Replacement.  Metadata entries stay on their own LRU list and are only
+// evicted when the policy has no victim or metadata exceeds its share.
+static const struct cache_policy *cache_policy = &cache_policy_2q;
+static struct list cache_meta_list; // Metadata entries, least recent first
+static size_t cache_meta_cnt; // Number of entries in cache_meta_list
+static size_t cache_meta_limit; // Metadata entries allowed before they are evicted first
+static bool cache_evict_clean; // Victims being sought must not need a write-back
+
+// Statistics.
+static long long cache_hits; // Accesses satisfied without reading the disk
+static long long cache_misses; // Accesses that read the disk
+static long long cache_evictions; // Entries evicted to make room
 struct lock cache_lock;
+struct condition cache_io_done;
 struct semaphore write_behind_success;
-struct list read_ahead_list;
-struct semaphore read_ahead_success;
-struct read_ahead_entry;
 
-void write_behind(void)
+// Bounded queue of sectors waiting to be prefetched.
+static block_sector_t read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+static size_t read_ahead_head; // Index of the oldest queued sector
+static size_t read_ahead_cnt; // Number of queued sectors
+static struct lock read_ahead_lock; // Protects the queue
+struct semaphore read_ahead_success; // Counts the queued sectors
+
+static unsigned cache_hash(const struct hash_elem *e, void *aux UNUSED)
 {
-    sema_init(&write_behind_success, 0);
+    const Cache *c = hash_entry(e, Cache, hash_elem);
+    return hash_int(c->sector_id);
+}
+
+static bool cache_less(const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED)
+{
+    return hash_entry(a, Cache, hash_elem)->sector_id < hash_entry(b, Cache, hash_elem)->sector_id;
+}
+
+static size_t cache_flush_batch(uint8_t *, int64_t);
+
+// Write-behind thread: flushes sectors that have been dirty for too long,
+// or any dirty sectors while too much of the cache is dirty.
+// It sleeps longer while there is nothing to do and not at all while
+// it is writing full batches.
+static void write_behind(void *aux UNUSED)
+{
+    uint8_t *buffer = palloc_get_page(PAL_ASSERT);
+    int64_t interval = WRITE_BEHIND_MIN_INTERVAL;
     while(!filesystem_shutdown) {
-        write_back_all_cache();
-        timer_sleep(200);
+        timer_sleep(interval);
+        size_t n = cache_flush_batch(buffer, timer_ticks() - WRITE_BEHIND_MAX_AGE);
+        if (n == WRITE_BEHIND_BATCH) {
+            interval = 0;
+        }
+        else if (n > 0) {
+            interval = WRITE_BEHIND_MIN_INTERVAL;
+        }
+        else if (interval < WRITE_BEHIND_MAX_INTERVAL) {
+            interval = interval == 0 ? WRITE_BEHIND_MIN_INTERVAL : interval * 2;
+            if (interval > WRITE_BEHIND_MAX_INTERVAL) {
+                interval = WRITE_BEHIND_MAX_INTERVAL;
+            }
+        }
     }
+    palloc_free_page(buffer);
     sema_up(&write_behind_success);
 }
 
-void read_ahead2(void)
+// Prefetch worker: loads queued sectors into the cache.
+// Each sector is inserted as an in-flight entry before the disk is
+// touched, so concurrent readers wait for it instead of reading it again.
+static void read_ahead_worker(void *aux UNUSED)
 {
     while(!filesystem_shutdown) {
         sema_down(&read_ahead_success);
-        struct read_ahead_entry *e = list_entry(list_pop_front(&read_ahead_list), struct read_ahead_entry, elem);
-        struct cache* c = cache_new(e->sector_id);
-        block_read(fs_device, e->sector_id, c->data);
-        free(e);
+        lock_acquire(&read_ahead_lock);
+        block_sector_t id = read_ahead_queue[read_ahead_head];
+        read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+        read_ahead_cnt--;
+        lock_release(&read_ahead_lock);
+
+        lock_acquire(&cache_lock);
+        Cache *c = cache_find_by_id(id) == NULL ? cache_new(id, false) : NULL;
+        if (c == NULL) {
+            // Already cached or in flight, or nothing can be evicted.
+            lock_release(&cache_lock);
+            continue;
+        }
+        c->loading = true;
+        lock_release(&cache_lock);
+
+        block_read(fs_device, id, c->data);
+
+        lock_acquire(&cache_lock);
+        c->loading = false;
+        cond_broadcast(&cache_io_done, &cache_lock);
+        lock_release(&cache_lock);
     }
 }
 
+// Queue sector <id> to be prefetched.
+// Never blocks on I/O; the request is dropped if the queue is full.
 void read_ahead(block_sector_t id)
 {
-    struct read_ahead_entry *e = malloc(sizeof(struct read_ahead_entry));
-    e->sector_id = id;
-    list_push_back(&read_ahead_list, &e->elem);
-    sema_up(&read_ahead_success);
+    lock_acquire(&read_ahead_lock);
+    if (read_ahead_cnt < READ_AHEAD_QUEUE_SIZE) {
+        read_ahead_queue[(read_ahead_head + read_ahead_cnt) % READ_AHEAD_QUEUE_SIZE] = id;
+        read_ahead_cnt++;
+        sema_up(&read_ahead_success);
+    }
+    lock_release(&read_ahead_lock);
+}
+
+// Allocate the cache array from the kernel pool.
+// If the requested size does not fit, halve it until it does.
+static void cache_alloc(void)
+{
+    if (cache_size < CACHE_MIN_SIZE) {
+        cache_size = CACHE_MIN_SIZE;
+    }
+    for(;;) {
+        size_t pages = DIV_ROUND_UP(cache_size * sizeof(Cache), PGSIZE);
+        cache = palloc_get_multiple(PAL_ZERO, pages);
+        if (cache != NULL) {
+            return;
+        }
+        if (cache_size == CACHE_MIN_SIZE) {
+            PANIC("cache_init: cannot allocate %zu cache entries", cache_size);
+        }
+        cache_size = cache_size / 2 < CACHE_MIN_SIZE ? CACHE_MIN_SIZE : cache_size / 2;
+    }
 }
 
 void cache_init(void)
 {
+    cache_alloc();
     lock_init(&cache_lock);
     lock_acquire(&cache_lock);
+    cond_init(&cache_io_done);
+    lock_init(&read_ahead_lock);
     sema_init(&read_ahead_success, 0);
-    list_init(&read_ahead_list);
     sema_init(&write_behind_success, 0);
-    for(int i = 0; i < CACHE_SIZE; i++) {
+    if (!hash_init(&cache_index, cache_hash, cache_less, NULL))
+        PANIC("cache_init: cannot allocate the sector index");
+    list_init(&cache_free_list);
+    list_init(&cache_dirty_list);
+    list_init(&cache_meta_list);
+    cache_meta_limit = cache_size * CACHE_META_RATIO / 100;
+    cache_policy->init();
+    cache_dirty_background = cache_size * CACHE_DIRTY_BACKGROUND_RATIO / 100;
+    cache_dirty_limit = cache_size * CACHE_DIRTY_RATIO / 100;
+    for(size_t i = 0; i < cache_size; i++) {
         cache[i].sector_id = CACHE_UNUSED;
         cache[i].dirty = false;
-        cache[i].second_chance = true;
+        cache[i].loading = false;
+        cache[i].flushing = false;
         lock_init(&cache[i].lock);
+        list_push_back(&cache_free_list, &cache[i].free_elem);
     }
-    thread_create ("read_ahead", PRI_DEFAULT, (thread_func *) read_ahead, NULL);
-    thread_create ("write_behind", PRI_DEFAULT, (thread_func *) write_behind, NULL);
+    thread_create ("read_ahead", PRI_DEFAULT, read_ahead_worker, NULL);
+    thread_create ("write_behind", PRI_DEFAULT, write_behind, NULL);
     lock_release(&cache_lock);
 }
 
-static void cache_flush(Cache* c)
+// Select the replacement policy named <name>.
+// Must be called before cache_init(). Returns false if there is no such policy.
+bool cache_set_policy(const char *name)
+{
+    static const struct cache_policy *policies[] = {
+        &cache_policy_clock, &cache_policy_2q,
+    };
+    for(size_t i = 0; i < sizeof policies / sizeof *policies; i++) {
+        if (!strcmp(name, policies[i]->name)) {
+            cache_policy = policies[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Print statistics about the cache.
+void cache_print_stats(void)
+{
+    printf("Cache: %lld hits, %lld misses, %lld evictions (%s, %zu sectors)\n",
+           cache_hits, cache_misses, cache_evictions, cache_policy->name, cache_size);
+}
+
+bool cache_try_lock(Cache *c)
+{
+    return !c->loading && !c->flushing && !(cache_evict_clean && c->dirty)
+           && lock_try_acquire(&c->lock);
+}
+
+// Start tracking the newly filled entry <c> for replacement.
+static void cache_track(Cache *c)
+{
+    if (c->meta) {
+        list_push_back(&cache_meta_list, &c->policy_elem);
+        cache_meta_cnt++;
+    }
+    else {
+        cache_policy->insert(c);
+    }
+}
+
+// Stop tracking <c> for replacement; <evicted> tells whether it leaves the cache.
+static void cache_untrack(Cache *c, bool evicted)
+{
+    if (c->meta) {
+        list_remove(&c->policy_elem);
+        cache_meta_cnt--;
+    }
+    else {
+        cache_policy->remove(c, evicted);
+    }
+}
+
+// Record a hit on <c>; <meta> promotes a data entry to metadata.
+static void cache_touch(Cache *c, bool meta)
+{
+    cache_hits++;
+    if (c->meta) {
+        list_remove(&c->policy_elem);
+        list_push_back(&cache_meta_list, &c->policy_elem);
+    }
+    else if (meta) {
+        cache_untrack(c, false);
+        c->meta = true;
+        cache_track(c);
+    }
+    else {
+        cache_policy->access(c);
+    }
+}
+
+// Return the least recently used metadata entry that can be locked, or NULL.
+static Cache* cache_meta_victim(void)
+{
+    for(struct list_elem *e = list_begin(&cache_meta_list); e != list_end(&cache_meta_list); e = list_next(e)) {
+        Cache *c = list_entry(e, Cache, policy_elem);
+        if (cache_try_lock(c)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+// Put <c> on the dirty list. Called with cache_lock held.
+static void cache_set_dirty(Cache* c)
+{
+    if (!c->dirty) {
+        c->dirty = true;
+        c->dirty_since = timer_ticks();
+        list_push_back(&cache_dirty_list, &c->dirty_elem);
+        cache_dirty_cnt++;
+    }
+}
+
+// Take <c> off the dirty list. Called with cache_lock held.
+static void cache_set_clean(Cache* c)
 {
     if (c->dirty) {
-        block_write(fs_device, c->sector_id, c->data);
         c->dirty = false;
+        list_remove(&c->dirty_elem);
+        cache_dirty_cnt--;
     }
-    else
+}
+
+// One sector of a write-behind batch.
+struct flush_slot {
+    Cache *c; // Entry being written, pinned by its flushing flag
+    uint8_t *data; // Snapshot of the entry's data
+};
+
+// Write back up to WRITE_BEHIND_BATCH dirty entries, oldest first.
+// Entries dirtied after <cutoff> are only taken while more than
+// cache_dirty_background entries are dirty.  Each entry is copied into
+// <buffer> under its own lock, then the batch is written in ascending
+// sector order without holding any lock.  Until the write completes the
+// entries are marked flushing so they cannot be evicted and reread stale.
+// Returns the number of sectors written.
+static size_t cache_flush_batch(uint8_t *buffer, int64_t cutoff)
+{
+    struct flush_slot batch[WRITE_BEHIND_BATCH];
+    size_t n = 0;
+
+    lock_acquire(&cache_lock);
+    struct list_elem *e = list_begin(&cache_dirty_list);
+    while (e != list_end(&cache_dirty_list) && n < WRITE_BEHIND_BATCH) {
+        Cache *c = list_entry(e, Cache, dirty_elem);
+        e = list_next(e);
+        if (c->dirty_since > cutoff && cache_dirty_cnt <= cache_dirty_background) {
+            break;
+        }
+        if (c->flushing || !lock_try_acquire(&c->lock)) {
+            continue;
+        }
+        // Insert into the batch, keeping it sorted by sector.
+        uint8_t *data = buffer + n * BLOCK_SECTOR_SIZE;
+        memcpy(data, c->data, BLOCK_SECTOR_SIZE);
+        cache_set_clean(c);
+        c->flushing = true;
+        lock_release(&c->lock);
+        size_t i = n++;
+        for(; i > 0 && batch[i - 1].c->sector_id > c->sector_id; i--) {
+            batch[i] = batch[i - 1];
+        }
+        batch[i].c = c;
+        batch[i].data = data;
+    }
+    cache_flushing_cnt += n;
+    lock_release(&cache_lock);
+
+    for(size_t i = 0; i < n; i++) {
+        block_write(fs_device, batch[i].c->sector_id, batch[i].data);
+    }
+
+    if (n > 0) {
+        lock_acquire(&cache_lock);
+        for(size_t i = 0; i < n; i++) {
+            batch[i].c->flushing = false;
+        }
+        cache_flushing_cnt -= n;
+        cond_broadcast(&cache_io_done, &cache_lock);
+        lock_release(&cache_lock);
+    }
+    return n;
+}
+
+// Flush dirty entries in the writer's own context while too much of the
+// cache is dirty, so that writers cannot outrun the write-behind thread.
+static void cache_throttle(void)
+{
+    uint8_t *buffer = palloc_get_page(0);
+    if (buffer == NULL) {
         return;
+    }
+    while (cache_dirty_cnt > cache_dirty_background
+           && cache_flush_batch(buffer, INT64_MIN) > 0) {
+        continue;
+    }
+    palloc_free_page(buffer);
 }
+
 // Write back all dirty cache.
 void write_back_all_cache(void)
 {
+    uint8_t *buffer = palloc_get_page(PAL_ASSERT);
+    while (cache_flush_batch(buffer, INT64_MAX) > 0) {
+        continue;
+    }
+    palloc_free_page(buffer);
+
+    // Wait for batches other threads are still writing.
     lock_acquire(&cache_lock);
-    for(int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].sector_id == CACHE_UNUSED) {
-            continue;
-        }
-        cache_flush(cache + i);
+    while (cache_flushing_cnt > 0) {
+        cond_wait(&cache_io_done, &cache_lock);
     }
     lock_release(&cache_lock);
 }
@@ -87,95 +383,241 @@ void write_back_all_cache(void)
 // Return NULL if not found.
 Cache* cache_find_by_id(block_sector_t id)
 {
-    for(int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].sector_id  ==  id) {
-            cache[i].second_chance = true;
-            return cache + i;
-        }
+    Cache key;
+    key.sector_id = id;
+    struct hash_elem *e = hash_find(&cache_index, &key.hash_elem);
+    if (e == NULL) {
+        return NULL;
     }
-    return NULL;
+    return hash_entry(e, Cache, hash_elem);
 }
 
-static Cache* cache_help_func(block_sector_t id)
+// Return the entry holding sector <id>, reading it from disk on a miss.
+// Called with cache_lock held; returns with only the entry's lock held.
+// A sector that is in flight is waited for rather than read twice.
+// <flags> is a combination of CACHE_WRITE, CACHE_META and CACHE_OVERWRITE.
+static Cache* cache_help_func(block_sector_t id, int flags)
 {
-    Cache *c = cache_find_by_id(id);
-    if (c == NULL) {
-        c = cache_new(id);
-        lock_acquire(&c->lock);
-        lock_release(&cache_lock); // it is safe to release the global lock when we have locked the cache's lock.
-        block_read(fs_device, id, c->data);
-    } else {
+    Cache *c;
+    bool meta = (flags & CACHE_META) != 0;
+    for(;;) {
+        c = cache_find_by_id(id);
+        if (c == NULL) {
+            c = cache_new(id, meta);
+            if (c != NULL) {
+                break;
+            }
+            if (cache_find_by_id(id) != NULL) {
+                // Brought in by another thread while a victim was written back.
+                continue;
+            }
+        }
+        else if (!c->loading) {
+            cache_touch(c, meta);
+            lock_acquire(&c->lock);
+            if (flags & CACHE_WRITE) {
+                cache_set_dirty(c);
+            }
+            lock_release(&cache_lock); // it is safe to release the global lock when we have locked the cache's lock.
+            return c;
+        }
+        cond_wait(&cache_io_done, &cache_lock);
+    }
+    if (flags & CACHE_OVERWRITE) {
+        // The caller replaces the whole sector, its old contents are never read.
         lock_acquire(&c->lock);
-        lock_release(&cache_lock); // it is safe to release the global lock when we have locked the cache's lock.
+        cache_set_dirty(c);
+        lock_release(&cache_lock);
+        return c;
     }
+    cache_misses++;
+    c->loading = true;
+    lock_release(&cache_lock);
+
+    block_read(fs_device, id, c->data);
+
+    lock_acquire(&cache_lock);
+    c->loading = false;
+    cond_broadcast(&cache_io_done, &cache_lock);
+    lock_acquire(&c->lock);
+    if (flags & CACHE_WRITE) {
+        cache_set_dirty(c);
+    }
+    lock_release(&cache_lock);
     return c;
 }
 
-// Load data from cache/disk to <data>
-void cache_read(block_sector_t id, void* data, int offset, int size)
+// Pin sector <id> in the cache and return its entry; the caller
+// accesses the sector in place through the entry's data and must
+// release it with cache_put() soon.  <flags> is a combination of
+// CACHE_WRITE, CACHE_META and CACHE_OVERWRITE; with CACHE_OVERWRITE the
+// caller must fill all of the data, which is then not read from disk.
+// Do not call cache_get() or any other cache function while holding a
+// pinned entry: the pin is the entry's lock, and waiting for the global
+// cache lock while holding it can deadlock.
+Cache* cache_get(block_sector_t id, int flags)
 {
+    if (flags & CACHE_OVERWRITE) {
+        flags |= CACHE_WRITE;
+    }
+    if ((flags & CACHE_WRITE) && cache_dirty_cnt >= cache_dirty_limit) {
+        cache_throttle();
+    }
     lock_acquire(&cache_lock);
-    Cache* c = cache_help_func(id);
-    memcpy(data, c->data + offset, size);
+    return cache_help_func(id, flags);
+}
+
+// Release entry <c> pinned by cache_get().
+void cache_put(Cache* c)
+{
     lock_release(&c->lock);
 }
 
+static void cache_do_read(block_sector_t id, void* data, int offset, int size, int flags)
+{
+    Cache* c = cache_get(id, flags);
+    memcpy(data, c->data + offset, size);
+    cache_put(c);
+}
+
+static void cache_do_write(block_sector_t id, const void* data, int offset, int size, int flags)
+{
+    if (offset == 0 && size == BLOCK_SECTOR_SIZE) {
+        flags |= CACHE_OVERWRITE;
+    }
+    Cache* c = cache_get(id, flags | CACHE_WRITE);
+    memcpy(c->data + offset, data, size);
+    cache_put(c);
+}
+
+// Load data from cache/disk to <data>
+void cache_read(block_sector_t id, void* data, int offset, int size)
+{
+    cache_do_read(id, data, offset, size, 0);
+}
+
 // Write data from <data> to cache
 void cache_write(block_sector_t id, const void* data, int offset, int size)
 {
-    lock_acquire(&cache_lock);
-    Cache* c = cache_help_func(id);
-    c->dirty = true;
-    memcpy(c->data + offset, data, size);
-    lock_release(&c->lock);
+    cache_do_write(id, data, offset, size, 0);
+}
+
+// Like cache_read(), for inodes, indirect blocks, directories and the
+// free map.  These sectors are kept resident in preference to file data.
+void cache_read_meta(block_sector_t id, void* data, int offset, int size)
+{
+    cache_do_read(id, data, offset, size, CACHE_META);
+}
+
+// Like cache_write(), for metadata.
+void cache_write_meta(block_sector_t id, const void* data, int offset, int size)
+{
+    cache_do_write(id, data, offset, size, CACHE_META);
 }
 
-Cache* cache_new(block_sector_t id)
+// Claim an entry for sector <id> and insert it into the index.
+// <meta> tells whether the sector holds metadata.
+Cache* cache_new(block_sector_t id, bool meta)
 {
     Cache *c = NULL;
-    for(int i = 0; i < CACHE_SIZE; i++) {
-        if (cache[i].sector_id == CACHE_UNUSED) {
-            c = cache + i;
-            break;
-        }
+    if (!list_empty(&cache_free_list)) {
+        c = list_entry(list_pop_front(&cache_free_list), Cache, free_elem);
     }
-    if (c == NULL) {
+    else {
         c = cache_evict();
+        if (c != NULL && cache_find_by_id(id) != NULL) {
+            // cache_evict() released cache_lock and <id> was brought in meanwhile.
+            list_push_back(&cache_free_list, &c->free_elem);
+            return NULL;
+        }
     }
     if (c == NULL) {
         //PANIC("cache_new: cannot find a cache entry");
         return NULL;
     }
-    c->second_chance = true;
     c->sector_id = id;
     c->dirty = false;
+    c->meta = meta;
+    hash_insert(&cache_index, &c->hash_elem);
+    cache_track(c);
+    return c;
+}
+
+// Return a locked victim: the replacement policy picks it unless
+// metadata has grown past its share.
+static Cache* cache_pick_victim(void)
+{
+    Cache *c = NULL;
+    if (cache_meta_cnt > cache_meta_limit) {
+        c = cache_meta_victim();
+    }
+    if (c == NULL) {
+        c = cache_policy->victim();
+    }
+    if (c == NULL) {
+        c = cache_meta_victim();
+    }
     return c;
 }
 
+// Write dirty victim <c>, locked by the caller, back to disk.
+// Like cache_flush_batch(), the entry is marked flushing and cache_lock
+// is released for the write.  The data is not snapshotted: a writer that
+// changes it meanwhile has dirtied the entry again, so it is rewritten
+// before it can be evicted.
+static void cache_write_victim(Cache *c)
+{
+    cache_set_clean(c);
+    c->flushing = true;
+    cache_flushing_cnt++;
+    lock_release(&c->lock);
+    lock_release(&cache_lock);
+
+    block_write(fs_device, c->sector_id, c->data);
+
+    lock_acquire(&cache_lock);
+    c->flushing = false;
+    cache_flushing_cnt--;
+    cond_broadcast(&cache_io_done, &cache_lock);
+}
+
 // Evict a cache entry.
 // Should be called when all cache entries are used.
+// The victim is dropped from the sector index; the caller reuses it.
+// Clean victims are preferred.  A dirty one is written back with
+// cache_lock released, after which the search starts over, so the
+// caller must revalidate anything it looked up before.  Entries being
+// read from or written to disk are skipped; returns NULL if every
+// entry is in flight.
 Cache* cache_evict(void)
 {
-    Cache *c = NULL;
-    for(int k = 1; k <= 10; k++) { // try hard to find a cache entry.
-        for(int i = 0; i < CACHE_SIZE; i++) {
-            if (lock_try_acquire(&cache[i].lock)) {
-                if (cache[i].second_chance) {
-                    cache[i].second_chance = false;
-                    lock_release(&cache[i].lock);
-                } 
-                else {
-                    c = cache + i;
-                }
-                break;
+    Cache *c;
+    for(;;) {
+        cache_evict_clean = true;
+        c = cache_pick_victim();
+        cache_evict_clean = false;
+        if (c == NULL) {
+            c = cache_pick_victim();
+        }
+        for(size_t i = 0; i < cache_size && c == NULL; i++) {
+            // Every entry is locked, wait for the first one not in flight.
+            if (!cache[i].loading && !cache[i].flushing) {
+                c = cache + i;
+                lock_acquire(&c->lock);
             }
         }
         if (c == NULL) {
-            continue;
+            return NULL;
         }
-        cache_flush(c);
-        c->sector_id = CACHE_UNUSED;
-        lock_release(&c->lock);
+        if (!c->dirty) {
+            break;
+        }
+        cache_write_victim(c);
     }
+    cache_evictions++;
+    cache_untrack(c, true);
+    hash_delete(&cache_index, &c->hash_elem);
+    c->sector_id = CACHE_UNUSED;
+    lock_release(&c->lock);
     return c;
 }
@@ -2,40 +2,65 @@
 #include <devices/block.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
 #include <threads/synch.h>
 
-#define CACHE_SIZE 64
+#define CACHE_DEFAULT_SIZE 256 // Default number of cached sectors (128 kB)
+#define CACHE_MIN_SIZE 16 // Never shrink the cache below this many sectors
 #define CACHE_UNUSED 1145141919
+#define READ_AHEAD_QUEUE_SIZE 64 // Maximum number of pending prefetches
+#define READ_AHEAD_WINDOW 8 // Sectors prefetched ahead of a sequential reader
+#define WRITE_BEHIND_BATCH 8 // Sectors written per flush, one page of snapshots
+#define WRITE_BEHIND_MAX_AGE 200 // Ticks a sector may stay dirty
+#define WRITE_BEHIND_MIN_INTERVAL 10 // Shortest write-behind sleep, in ticks
+#define WRITE_BEHIND_MAX_INTERVAL 100 // Longest write-behind sleep, in ticks
+#define CACHE_DIRTY_BACKGROUND_RATIO 10 // Percent dirty before age is ignored
+#define CACHE_DIRTY_RATIO 30 // Percent dirty before writers flush themselves
+#define CACHE_META_RATIO 50 // Percent of the cache metadata may keep resident
+
+// Flags of a cache access.
+#define CACHE_WRITE 0x1 // The access modifies the sector
+#define CACHE_META 0x2 // The sector holds file system metadata
+#define CACHE_OVERWRITE 0x4 // The whole sector is rewritten, do not read it
 
 // File system cache
 typedef struct cache
 {
     block_sector_t sector_id; // The sector id
     bool dirty; // Whether this cache has changed
-    bool second_chance; // Second chance algorithm
+    bool second_chance; // Referenced bit of the clock policy
+    bool meta; // Holds file system metadata, see cache_read_meta()
+    uint8_t policy_queue; // Queue of the replacement policy holding the entry
+    bool loading; // Being read from disk, wait on cache_io_done
+    bool flushing; // Snapshot being written to disk, must not be evicted
+    int64_t dirty_since; // Tick at which the entry became dirty
     uint8_t data[BLOCK_SECTOR_SIZE]; // The data block of the cache
     struct lock lock; // When read or write, lock
+    struct hash_elem hash_elem; // Element in the sector index, while in use
+    struct list_elem free_elem; // Element in the free list, while unused
+    struct list_elem dirty_elem; // Element in the dirty list, while dirty
+    struct list_elem policy_elem; // Element in a replacement policy queue
 } Cache;
 
-struct read_ahead_entry {
-    struct list_elem elem; // The list element of readahead
-    block_sector_t sector_id; // readahead sector id
-};
-
-
+extern size_t cache_size; // Number of cached sectors, set by "-cache"
 extern struct lock cache_lock;
+extern struct condition cache_io_done;
 extern struct semaphore write_behind_success;
 
-extern struct list read_ahead_list;
 extern struct semaphore read_ahead_success;
 
-void write_behind(void);
-void read_ahead2(void);
 void read_ahead(block_sector_t);
 void cache_init(void);
+bool cache_set_policy(const char *);
+void cache_print_stats(void);
+struct cache* cache_get(block_sector_t, int);
+void cache_put(struct cache*);
 void cache_read(block_sector_t, void*, int,int);
 void cache_write(block_sector_t, const void*,int,int);
-struct cache* cache_find(block_sector_t);
-struct cache* cache_new(block_sector_t);
+void cache_read_meta(block_sector_t, void*, int,int);
+void cache_write_meta(block_sector_t, const void*,int,int);
+struct cache* cache_find_by_id(block_sector_t);
+struct cache* cache_new(block_sector_t, bool);
 struct cache* cache_evict(void);
 void write_back_all_cache(void);
\ No newline at end of file
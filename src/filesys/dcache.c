@@ -0,0 +1,139 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+// A cached name.
+struct dentry
+{
+    block_sector_t dir; // Sector of the directory holding the name
+    char name[NAME_MAX + 1]; // The name, null terminated
+    block_sector_t sector; // Inode sector of the name, or DCACHE_ABSENT
+    struct hash_elem hash_elem; // Element in dcache_index, while in use
+    struct list_elem lru_elem; // Element in dcache_lru
+};
+
+static struct dentry dcache[DCACHE_SIZE];
+static struct hash dcache_index; // Entries in use, keyed by (dir, name)
+static struct list dcache_lru; // All entries, least recently used first; unused ones at the front
+static struct lock dcache_lock; // Protects all of the above, never held across I/O
+
+static unsigned dcache_hash(const struct hash_elem *e, void *aux UNUSED)
+{
+    const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+    return hash_string(d->name) ^ hash_int(d->dir);
+}
+
+static bool dcache_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED)
+{
+    const struct dentry *a = hash_entry(a_, struct dentry, hash_elem);
+    const struct dentry *b = hash_entry(b_, struct dentry, hash_elem);
+    if (a->dir != b->dir) {
+        return a->dir < b->dir;
+    }
+    return strcmp(a->name, b->name) < 0;
+}
+
+void dcache_init(void)
+{
+    if (!hash_init(&dcache_index, dcache_hash, dcache_less, NULL))
+        PANIC("dcache: cannot allocate the index");
+    list_init(&dcache_lru);
+    lock_init(&dcache_lock);
+    for(size_t i = 0; i < DCACHE_SIZE; i++) {
+        dcache[i].sector = DCACHE_ABSENT;
+        dcache[i].name[0] = '\0';
+        list_push_back(&dcache_lru, &dcache[i].lru_elem);
+    }
+}
+
+// Return the entry for <name> in <dir>, or NULL.  Names too long to be
+// stored are never cached.  Called with dcache_lock held.
+static struct dentry *dcache_find(block_sector_t dir, const char *name)
+{
+    struct dentry key;
+    struct hash_elem *e;
+
+    if (strlen(name) > NAME_MAX)
+        return NULL;
+    key.dir = dir;
+    strlcpy(key.name, name, sizeof key.name);
+    e = hash_find(&dcache_index, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+// Make <d> unused and the first to be reused.
+static void dcache_drop(struct dentry *d)
+{
+    hash_delete(&dcache_index, &d->hash_elem);
+    d->name[0] = '\0';
+    list_remove(&d->lru_elem);
+    list_push_front(&dcache_lru, &d->lru_elem);
+}
+
+// Look up <name> in directory <dir>.  On a hit, store the inode sector it
+// names, or DCACHE_ABSENT if it is known not to exist, into <sector> and
+// return true.  Return false if nothing is cached.
+bool dcache_lookup(block_sector_t dir, const char *name, block_sector_t *sector)
+{
+    lock_acquire(&dcache_lock);
+    struct dentry *d = dcache_find(dir, name);
+    if (d != NULL) {
+        *sector = d->sector;
+        list_remove(&d->lru_elem);
+        list_push_back(&dcache_lru, &d->lru_elem);
+    }
+    lock_release(&dcache_lock);
+    return d != NULL;
+}
+
+// Remember that <name> in <dir> names the inode at <sector>, or does not
+// exist if <sector> is DCACHE_ABSENT, replacing any previous entry.
+void dcache_insert(block_sector_t dir, const char *name, block_sector_t sector)
+{
+    if (*name == '\0' || strlen(name) > NAME_MAX)
+        return;
+
+    lock_acquire(&dcache_lock);
+    struct dentry *d = dcache_find(dir, name);
+    if (d == NULL) {
+        d = list_entry(list_front(&dcache_lru), struct dentry, lru_elem);
+        if (d->name[0] != '\0') {
+            hash_delete(&dcache_index, &d->hash_elem);
+        }
+        d->dir = dir;
+        strlcpy(d->name, name, sizeof d->name);
+        hash_insert(&dcache_index, &d->hash_elem);
+    }
+    d->sector = sector;
+    list_remove(&d->lru_elem);
+    list_push_back(&dcache_lru, &d->lru_elem);
+    lock_release(&dcache_lock);
+}
+
+// Forget what is known about <name> in <dir>.
+void dcache_invalidate(block_sector_t dir, const char *name)
+{
+    lock_acquire(&dcache_lock);
+    struct dentry *d = dcache_find(dir, name);
+    if (d != NULL) {
+        dcache_drop(d);
+    }
+    lock_release(&dcache_lock);
+}
+
+// Forget every name in <dir>, which is being deleted, so that nothing is
+// found there once its sector is reused.
+void dcache_purge_dir(block_sector_t dir)
+{
+    lock_acquire(&dcache_lock);
+    for(size_t i = 0; i < DCACHE_SIZE; i++) {
+        if (dcache[i].name[0] != '\0' && dcache[i].dir == dir) {
+            dcache_drop(&dcache[i]);
+        }
+    }
+    lock_release(&dcache_lock);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+#include "devices/block.h"
+
+// Directory entry cache: remembers which inode sector a name in a
+// directory refers to, or that the name does not exist, so that path
+// resolution need not scan the directory again.  Callers serialize
+// per directory by holding the directory's dir_lock.
+
+#define DCACHE_SIZE 256 // Number of cached names
+#define DCACHE_ABSENT ((block_sector_t) -1) // Sector of a negative entry
+
+void dcache_init(void);
+bool dcache_lookup(block_sector_t dir, const char *name, block_sector_t *sector);
+void dcache_insert(block_sector_t dir, const char *name, block_sector_t sector);
+void dcache_invalidate(block_sector_t dir, const char *name);
+void dcache_purge_dir(block_sector_t dir);
@@ -1,11 +1,20 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
+/* If true, dir_create() makes hashed directories.
+   Chosen by "-hashdir" at format time, read back from the root
+   directory otherwise. */
+bool dir_use_hash;
+
 /* A directory. */
 struct dir
 {
@@ -21,16 +30,70 @@ struct dir_entry
 	bool in_use;                        /* In use or free? */
 };
 
+/* Directory entries read at once by lookup(). */
+#define LOOKUP_BATCH (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* A hashed directory is an array of sector-sized buckets.  An
+   entry lives in the bucket its name hashes to or, if that is
+   full, in one of the buckets after it (linear probing).  A
+   bucket that has been passed over this way is marked as
+   overflowed, so a lookup can stop at the first bucket that never
+   overflowed.  Marks are not cleared on removal, only when the
+   directory is rehashed into twice as many buckets. */
+
+/* Entries per bucket. */
+#define BUCKET_ENTRIES ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) \
+                        / sizeof (struct dir_entry))
+
+/* Buckets an insertion may probe before the directory grows. */
+#define MAX_PROBE 4
+
+/* One bucket of a hashed directory.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct dir_bucket
+{
+	struct dir_entry entries[BUCKET_ENTRIES];
+	uint32_t overflow;                  /* Nonzero once passed over. */
+	uint8_t unused[BLOCK_SECTOR_SIZE - BUCKET_ENTRIES * sizeof (struct dir_entry)
+		- sizeof (uint32_t)];
+};
+
+/* Returns true if DIR is a hashed directory. */
+static bool is_hashed(const struct dir* dir) {
+	return inode_dir_format(dir->inode) == DIR_FORMAT_HASHED;
+}
+
+/* Returns the number of buckets in hashed directory INODE. */
+static size_t bucket_cnt(const struct inode* inode) {
+	return inode_length(inode) / BLOCK_SECTOR_SIZE;
+}
+
+/* Reads bucket IDX of hashed directory INODE into *B. */
+static bool read_bucket(struct inode* inode, size_t idx, struct dir_bucket* b) {
+	return inode_read_at(inode, b, sizeof * b, idx * BLOCK_SECTOR_SIZE) == sizeof * b;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, in the format selected by dir_use_hash.
+   Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt) {
-	bool success = inode_create(sector, entry_cnt * sizeof(struct dir_entry));
+	unsigned format = dir_use_hash ? DIR_FORMAT_HASHED : DIR_FORMAT_LINEAR;
+	off_t length;
+
+	ASSERT(sizeof(struct dir_bucket) == BLOCK_SECTOR_SIZE);
+	if (format == DIR_FORMAT_HASHED)
+		length = DIV_ROUND_UP(entry_cnt > 0 ? entry_cnt : 1, BUCKET_ENTRIES)
+			* BLOCK_SECTOR_SIZE;
+	else
+		length = entry_cnt * sizeof(struct dir_entry);
+
+	bool success = inode_create(sector, length);
 	if (!success) return false;
 	// Create inode
 	Inode* inode = inode_open(sector);
 	if (inode == NULL) return false;
 	// Create . and ..
-	inode_set_dir(inode, true);
+	inode_set_dir(inode, format);
 	inode_close(inode);
 	return true;
 }
@@ -79,29 +142,175 @@ struct inode* dir_get_inode(struct dir* dir) {
 	return dir->inode;
 }
 
+/* lookup() for a hashed directory: probes from the bucket NAME
+   hashes to until a bucket that never overflowed. */
+static bool hashed_lookup(const struct dir* dir, const char* name,
+	struct dir_entry* ep, off_t* ofsp) {
+	struct dir_bucket b;
+	size_t cnt = bucket_cnt(dir->inode);
+	size_t home = hash_string(name) % cnt;
+	size_t i, j;
+
+	for (i = 0; i < cnt; i++)
+	{
+		size_t idx = (home + i) % cnt;
+		if (!read_bucket(dir->inode, idx, &b))
+			return false;
+		for (j = 0; j < BUCKET_ENTRIES; j++)
+			if (b.entries[j].in_use && !strcmp(name, b.entries[j].name))
+			{
+				if (ep != NULL)
+					*ep = b.entries[j];
+				if (ofsp != NULL)
+					*ofsp = idx * BLOCK_SECTOR_SIZE + j * sizeof b.entries[j];
+				return true;
+			}
+		if (!b.overflow)
+			return false;
+	}
+	return false;
+}
+
+/* Stores E in a free slot of hashed directory INODE, which has CNT
+   buckets, probing at most MAX buckets from E's home bucket and
+   marking each full one as overflowed.  Returns true if
+   successful, false if no slot was found or a disk error
+   occurred. */
+static bool bucket_insert(struct inode* inode, size_t cnt,
+	const struct dir_entry* e, size_t max) {
+	struct dir_bucket b;
+	size_t home = hash_string(e->name) % cnt;
+	size_t i, j;
+
+	for (i = 0; i < max && i < cnt; i++)
+	{
+		size_t idx = (home + i) % cnt;
+		off_t ofs = idx * BLOCK_SECTOR_SIZE;
+		if (!read_bucket(inode, idx, &b))
+			return false;
+		for (j = 0; j < BUCKET_ENTRIES; j++)
+			if (!b.entries[j].in_use)
+				return inode_write_at(inode, e, sizeof * e, ofs + j * sizeof * e)
+					== sizeof * e;
+		if (!b.overflow)
+		{
+			b.overflow = 1;
+			if (inode_write_at(inode, &b.overflow, sizeof b.overflow,
+				ofs + offsetof(struct dir_bucket, overflow)) != sizeof b.overflow)
+				return false;
+		}
+	}
+	return false;
+}
+
+/* Doubles the number of buckets in hashed directory DIR and
+   rehashes its entries, which are copied aside into a scratch
+   inode first so that memory use does not depend on the
+   directory's size.  All disk allocation happens before DIR's
+   contents are touched, so on failure DIR is usually left as it
+   was.  Only a disk error while rehashing can lose entries from
+   DIR; the scratch inode holding them is then kept on disk. */
+static bool grow(struct dir* dir) {
+	struct inode* inode = dir->inode;
+	struct inode* scratch = NULL;
+	struct dir_bucket* b = malloc(sizeof * b);
+	size_t cnt = bucket_cnt(inode);
+	block_sector_t sector = 0;
+	bool rehashing = false;
+	bool success = false;
+	size_t i, j;
+
+	if (b == NULL || !free_map_allocate(1, &sector))
+		goto done;
+	if (!inode_create(sector, cnt * BLOCK_SECTOR_SIZE))
+	{
+		free_map_release(sector, 1);
+		goto done;
+	}
+	scratch = inode_open(sector);
+	if (scratch == NULL)
+		goto done;
+
+	/* Copy the buckets aside, then double the directory with a
+	   single write so that its length changes all at once. */
+	for (i = 0; i < cnt; i++)
+		if (!read_bucket(inode, i, b)
+			|| inode_write_at(scratch, b, sizeof * b, i * BLOCK_SECTOR_SIZE) != sizeof * b)
+			goto done;
+	memset(b, 0, sizeof * b);
+	if (inode_write_at(inode, b, sizeof * b, (2 * cnt - 1) * BLOCK_SECTOR_SIZE) != sizeof * b)
+		goto done;
+
+	/* Clear the old buckets and reinsert every entry.  From here
+	   on the entries are only safe in SCRATCH until reinserted. */
+	rehashing = true;
+	for (i = 0; i < cnt; i++)
+		if (inode_write_at(inode, b, sizeof * b, i * BLOCK_SECTOR_SIZE) != sizeof * b)
+			goto done;
+	for (i = 0; i < cnt; i++)
+	{
+		if (!read_bucket(scratch, i, b))
+			goto done;
+		for (j = 0; j < BUCKET_ENTRIES; j++)
+			if (b->entries[j].in_use
+				&& !bucket_insert(inode, 2 * cnt, &b->entries[j], 2 * cnt))
+				goto done;
+	}
+	success = true;
+
+done:
+	if (scratch != NULL)
+	{
+		if (rehashing && !success)
+		{
+			/* Cached lookups may name entries DIR no longer has. */
+			dcache_purge_dir(inode_get_inumber(inode));
+			printf("dir: rehashing directory %"PRDSNu" failed, "
+				"its entries are kept in inode %"PRDSNu"\n",
+				inode_get_inumber(inode), sector);
+		}
+		else
+			inode_remove(scratch);
+		inode_close(scratch);
+	}
+	free(b);
+	return success;
+}
+
 /* Searches DIR for a file with the given NAME.
+   The caller must hold DIR's dir_lock.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
    otherwise, returns false and ignores EP and OFSP. */
 static bool lookup(const struct dir* dir, const char* name,
 	struct dir_entry* ep, off_t* ofsp) {
-	struct dir_entry e;
-	size_t ofs;
+	struct dir_entry entries[LOOKUP_BATCH];
+	off_t ofs, size;
 
 	ASSERT(dir != NULL);
 	ASSERT(name != NULL);
 
-	for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-		ofs += sizeof e)
-		if (e.in_use && !strcmp(name, e.name))
-		{
-			if (ep != NULL)
-				*ep = e;
-			if (ofsp != NULL)
-				*ofsp = ofs;
-			return true;
-		}
+	if (is_hashed(dir))
+		return hashed_lookup(dir, name, ep, ofsp);
+
+	/* Read a sector's worth of entries per inode_read_at(), which
+	   holds the directory's inode shared while it copies them. */
+	for (ofs = 0; (size = inode_read_at(dir->inode, entries, sizeof entries, ofs))
+		>= (off_t)sizeof *entries; ofs += size)
+	{
+		size_t cnt = size / sizeof *entries, i;
+		for (i = 0; i < cnt; i++)
+			if (entries[i].in_use && !strcmp(name, entries[i].name))
+			{
+				if (ep != NULL)
+					*ep = entries[i];
+				if (ofsp != NULL)
+					*ofsp = ofs + i * sizeof *entries;
+				return true;
+			}
+		size = cnt * sizeof *entries;
+	}
 	return false;
 }
 
@@ -114,14 +323,34 @@ dir_lookup(const struct dir* dir, const char* name,
 	struct inode** inode)
 {
 	struct dir_entry e;
+	block_sector_t dir_sector;
+	block_sector_t sector;
 
 	ASSERT(dir != NULL);
 	ASSERT(name != NULL);
 
-	if (lookup(dir, name, &e, NULL))
+	dir_sector = inode_get_inumber(dir->inode);
+
+	/* Hold the directory across inode_open() so that the entry
+	   cannot be removed and its inode freed in between.  Names in a
+	   removed directory are not cached, since its sector may be
+	   reused. */
+	lock_acquire(&dir->inode->dir_lock);
+	if (!dir->inode->removed && dcache_lookup(dir_sector, name, &sector))
+		*inode = sector != DCACHE_ABSENT ? inode_open(sector) : NULL;
+	else if (lookup(dir, name, &e, NULL))
+	{
 		*inode = inode_open(e.inode_sector);
+		if (!dir->inode->removed)
+			dcache_insert(dir_sector, name, e.inode_sector);
+	}
 	else
+	{
 		*inode = NULL;
+		if (!dir->inode->removed)
+			dcache_insert(dir_sector, name, DCACHE_ABSENT);
+	}
+	lock_release(&dir->inode->dir_lock);
 
 	return *inode != NULL;
 }
@@ -130,8 +359,8 @@ dir_lookup(const struct dir* dir, const char* name,
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
    Returns true if successful, false on failure.
-   Fails if NAME is invalid (i.e. too long) or a disk or memory
-   error occurs. */
+   Fails if NAME is invalid (i.e. too long), if DIR has been
+   removed, or if a disk or memory error occurs. */
 bool
 dir_add(struct dir* dir, const char* name, block_sector_t inode_sector)
 {
@@ -146,9 +375,23 @@ dir_add(struct dir* dir, const char* name, block_sector_t inode_sector)
 	if (*name == '\0' || strlen(name) > NAME_MAX)
 		return false;
 
-	/* Check that NAME is not in use. */
-	if (lookup(dir, name, NULL, NULL))
+	lock_acquire(&dir->inode->dir_lock);
+
+	/* Check that DIR is still linked and NAME is not in use. */
+	if (dir->inode->removed || lookup(dir, name, NULL, NULL))
+		goto done;
+
+	if (is_hashed(dir))
+	{
+		memset(&e, 0, sizeof e);
+		e.in_use = true;
+		strlcpy(e.name, name, sizeof e.name);
+		e.inode_sector = inode_sector;
+		success = bucket_insert(dir->inode, bucket_cnt(dir->inode), &e, MAX_PROBE)
+			|| (grow(dir) && bucket_insert(dir->inode, bucket_cnt(dir->inode), &e,
+				bucket_cnt(dir->inode)));
 		goto done;
+	}
 
 	/* Set OFS to offset of free slot.
 	   If there are no free slots, then it will be set to the
@@ -169,6 +412,9 @@ dir_add(struct dir* dir, const char* name, block_sector_t inode_sector)
 	success = inode_write_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
 
 done:
+	if (success)
+		dcache_insert(dir->inode->sector, name, inode_sector);
+	lock_release(&dir->inode->dir_lock);
 	return success;
 }
 
@@ -186,6 +432,8 @@ dir_remove(struct dir* dir, const char* name)
 	ASSERT(dir != NULL);
 	ASSERT(name != NULL);
 
+	lock_acquire(&dir->inode->dir_lock);
+
 	/* Find directory entry. */
 	if (!lookup(dir, name, &e, &ofs))
 		goto done;
@@ -200,26 +448,45 @@ dir_remove(struct dir* dir, const char* name)
 	if (inode_write_at(dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
 
-	/* Remove inode. */
+	/* Remove inode, and forget the names in it if it is a directory,
+	   whose sector will be reused. */
+	dcache_invalidate(dir->inode->sector, name);
 	inode_remove(inode);
+	if (inode_is_dir(inode))
+		dcache_purge_dir(e.inode_sector);
 	success = true;
 
 done:
+	lock_release(&dir->inode->dir_lock);
 	inode_close(inode);
 	return success;
 }
 
+/* Reads the directory entry at byte offset *OFSP in DIR into *EP
+   and advances *OFSP past it, skipping the tail of each bucket in
+   a hashed directory.  Returns false at the end of DIR. */
+static bool read_entry(const struct dir* dir, off_t* ofsp, struct dir_entry* ep) {
+	if (is_hashed(dir)
+		&& *ofsp % BLOCK_SECTOR_SIZE >= (off_t)(BUCKET_ENTRIES * sizeof * ep))
+		*ofsp = ROUND_UP(*ofsp, BLOCK_SECTOR_SIZE);
+	if (inode_read_at(dir->inode, ep, sizeof * ep, *ofsp) != sizeof * ep)
+		return false;
+	*ofsp += sizeof * ep;
+	return true;
+}
+
 /* Reads the next directory entry in DIR and stores the name in
    NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   contains no more entries.
+   Entries of a hashed directory that is rehashed between calls
+   may be returned twice or not at all. */
 bool
 dir_readdir(struct dir* dir, char name[NAME_MAX + 1])
 {
 	struct dir_entry e;
 
-	while (inode_read_at(dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+	while (read_entry(dir, &dir->pos, &e))
 	{
-		dir->pos += sizeof e;
 		// strcmp returns 0 if the strings are equal
 		// So this requires no "." or ".." entries
 		if (e.in_use && strcmp(e.name, ".") && strcmp(e.name, ".."))
@@ -231,14 +498,17 @@ dir_readdir(struct dir* dir, char name[NAME_MAX + 1])
 	return false;
 }
 
+/* Returns true if DIR has no entries other than "." and "..".
+   The answer may be stale by the time it is returned unless the
+   caller holds DIR's dir_lock. */
 bool dir_is_empty(struct dir* dir) {
 	struct dir_entry e;
 	off_t ofs;
 
 	ASSERT(dir != NULL);
 
-	for (ofs = 0; inode_read_at(dir->inode, &e, sizeof e, ofs) == sizeof e;
-		ofs += sizeof e)
+	ofs = 0;
+	while (read_entry(dir, &ofs, &e))
 		if (e.in_use && strcmp(e.name, ".") && strcmp(e.name, ".."))
 			return false;
 
@@ -11,6 +11,13 @@
    retained, but much longer full path names must be allowed. */
 #define NAME_MAX 14
 
+/* Directory formats, kept in the directory's inode. */
+#define DIR_FORMAT_LINEAR 1     /* Unordered array of entries. */
+#define DIR_FORMAT_HASHED 2     /* Sector-sized hash buckets. */
+
+/* If true, dir_create() makes hashed directories. */
+extern bool dir_use_hash;
+
 struct inode;
 
 /* Opening and closing directories. */
@@ -4,12 +4,7 @@
 #include "filesys/off_t.h"
 
 struct inode;
-#define assert_held_by_cur() return
-void filesys_lock_acquire (void);
-void filesys_lock_release (void);
-void acquire_filesys_lock (void);
-void release_filesys_lock (void);
-void filesys_lock_init (void);
+
 /* Opening and closing files. */
 struct file *file_open (struct inode *);
 struct file *file_reopen (struct file *);
@@ -8,6 +8,7 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 
 /* Partition that contains the file system. */
 struct block* fs_device;
@@ -84,9 +85,7 @@ bool open_parentdir_get_basename(const char* name, struct dir** dir, char** base
 		return false;
 	}
 
-	filesys_lock_acquire ();
 	struct dir* parent_dir = try_dir_open(parent_dir_path);
-	filesys_lock_release ();
 
 	free(parent_dir_path);
 	if(parent_dir == NULL) {
@@ -127,24 +126,20 @@ bool filesys_open_file_or_dir(const char* name, struct file **file, struct dir *
 	if(!open_parentdir_get_basename(name, &parent_dir, &basename)) {
 		return false;
 	}
-	filesys_lock_acquire();
 	Inode* inode = NULL;
 	dir_lookup(parent_dir, basename, &inode);
 	dir_close(parent_dir);
 	if(inode == NULL) {	
-		filesys_lock_release ();
 		return false;
 	}
 	open_with_inode(inode, file, dir);
 	//free(basename);
-	filesys_lock_release ();
 	return true;
 }
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
 void filesys_init(bool format) {
-	filesys_lock_init();
 	fs_device = block_get_role(BLOCK_FILESYS);
 	if (fs_device == NULL)
 		PANIC("No file system device found, can't initialize file system.");
@@ -153,10 +148,23 @@ void filesys_init(bool format) {
 	cache_init();
 
 	inode_init();
+	dcache_init();
 	free_map_init();
 
 	if (format)
 		do_format();
+	else {
+		/* New inodes use the format the disk was formatted with,
+		   which is that of the free map inode. */
+		Inode* free_map_inode = inode_open(FREE_MAP_SECTOR);
+		inode_use_extents = inode_has_extents(free_map_inode);
+		inode_close(free_map_inode);
+
+		/* Likewise, new directories use the format of the root. */
+		Inode* root_inode = inode_open(ROOT_DIR_SECTOR);
+		dir_use_hash = inode_dir_format(root_inode) == DIR_FORMAT_HASHED;
+		inode_close(root_inode);
+	}
 
 	free_map_open();
 	filesystem_shutdown = false;
@@ -165,13 +173,12 @@ void filesys_init(bool format) {
 /* Shuts down the file system module, writing any unwritten data
    to disk. */
 void filesys_done(void) {
-	filesys_lock_acquire();
+	free_map_flush();
 	write_back_all_cache();
 	sema_up(&write_behind_success);
   	sema_down (&write_behind_success);
 	free_map_close();
 	filesystem_shutdown = true;
-	filesys_lock_release ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -188,7 +195,6 @@ filesys_create(const char* name, off_t initial_size)
 		return false;
 	}
 	// Create Directory
-	filesys_lock_acquire();
 	block_sector_t inode_sector = 0;
 	bool success = (parent_dir != NULL
 		&& free_map_allocate(1, &inode_sector)
@@ -197,7 +203,6 @@ filesys_create(const char* name, off_t initial_size)
 	if (!success && inode_sector != 0)
 		free_map_release(inode_sector, 1);
 	dir_close(parent_dir);
-	filesys_lock_release ();
 	return success;
 }
 
@@ -213,13 +218,10 @@ struct file* filesys_open(const char* name) {
 		return NULL;
 	}
 	//("filesys_open");
-	filesys_lock_acquire();
 	Inode* inode = NULL;
 	dir_lookup(parent_dir, basename, &inode);
 	dir_close(parent_dir);
-	struct file* file = file_open(inode);
-	filesys_lock_release ();
-	return file;
+	return file_open(inode);
 }
 
 /* Deletes the file named NAME.
@@ -231,7 +233,6 @@ bool filesys_remove(const char* name) {
 	char* basename;
 	if (!open_parentdir_get_basename(name, &parent_dir, &basename))
 		return false;
-	filesys_lock_acquire();
 	Inode* inode;
 	dir_lookup(parent_dir, basename, &inode);
 
@@ -239,14 +240,18 @@ bool filesys_remove(const char* name) {
 
 	if (!inode) {
 		dir_close(parent_dir);
-		filesys_lock_release ();
 		return false;
 	}
 	if (inode_is_dir(inode)) {
+		// Hold the victim's lock so nothing is added to it between
+		// the emptiness check and the unlink.  This is the only place
+		// that takes two directory locks, child before parent.
 		struct dir* d = dir_open(inode);
-		if (dir_get_inode(d)->open_cnt == 1 && dir_is_empty(d)){ 
+		lock_acquire(&inode->dir_lock);
+		if (inode_open_cnt(inode) == 1 && dir_is_empty(d)){ 
 			success = dir_remove(parent_dir, basename);
 		}
+		lock_release(&inode->dir_lock);
 		dir_close(d);
 	}
 	else {
@@ -255,7 +260,6 @@ bool filesys_remove(const char* name) {
 	}
 
 	dir_close(parent_dir);
-	filesys_lock_release ();
 	return success;
 }
 
@@ -265,35 +269,40 @@ bool filesys_mkdir(const char* name) {
 	if(!open_parentdir_get_basename(name, &parent_dir, &basename)) {
 		return false;
 	}
-	filesys_lock_acquire();
 	// Create Directory
 	Inode* inode = NULL;
 	if(dir_lookup(parent_dir, basename, &inode)) {
 		inode_close(inode);
 		dir_close(parent_dir);
-		filesys_lock_release ();
 		return false;
 	}
 	block_sector_t inode_sector = 0;
-	free_map_allocate(1, &inode_sector);
+	if (!free_map_allocate(1, &inode_sector)) {
+		dir_close(parent_dir);
+		return false;
+	}
 	dir_create(inode_sector, 16);
 	struct dir* dir = dir_open(inode_open(inode_sector));
 	dir_add(dir, ".", inode_sector);
 	dir_add(dir, "..", inode_get_inumber(dir_get_inode(parent_dir)));
-	dir_add(parent_dir, basename, inode_sector);
+
+	// Another process may have taken the name since the lookup above;
+	// dir_add() checks again under the parent's lock.
+	bool success = dir_add(parent_dir, basename, inode_sector);
+	if (!success) {
+		inode_remove(dir_get_inode(dir));
+		dcache_purge_dir(inode_sector);
+	}
 
 	dir_close(dir);
 	dir_close(parent_dir);
-	filesys_lock_release ();
-	return true;
+	return success;
 }
 
 bool filesys_chdir(const char* name) {
 	struct file* file;
 	struct dir* dir;
-	filesys_lock_acquire();
 	if(!filesys_open_file_or_dir(name, &file, &dir) || dir == NULL) {
-		filesys_lock_release ();
 		return false;
 	}
 	struct thread* cur = thread_current();
@@ -301,13 +310,11 @@ bool filesys_chdir(const char* name) {
 		dir_close(cur->cwd);
 	}
 	cur->cwd = dir;
-	filesys_lock_release ();
 	return true;
 }
 
 /* Formats the file system. */
 static void do_format(void) {
-	filesys_lock_acquire();
 	printf("Formatting file system...");
 	free_map_create();
 	if (!dir_create(ROOT_DIR_SECTOR, 16))
@@ -318,5 +325,4 @@ static void do_format(void) {
 	dir_close(root);
 	free_map_close();
 	printf("done.\n");
-	filesys_lock_release ();
 }
@@ -1,12 +1,26 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Free map bits stored in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_map_dirty; /* Free map file sectors to flush. */
+static block_sector_t free_map_cursor; /* Where next-fit search starts. */
+static struct lock free_map_lock;    /* Protects all of the above. */
+
+/* Serializes free_map_flush(), so that an older copy of a sector
+   is never written over a newer one.  Held across I/O, but never
+   by allocation or release. */
+static struct lock free_map_flush_lock;
+static uint8_t free_map_buffer[BLOCK_SECTOR_SIZE]; /* Sector being flushed. */
 
 /* Initializes the free map. */
 void
@@ -15,38 +29,164 @@ free_map_init (void)
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  free_map_cursor = 0;
+  lock_init (&free_map_lock);
+  lock_init (&free_map_flush_lock);
+}
+
+/* Notes that the bits of CNT sectors starting at SECTOR changed,
+   so the free map file sectors holding them must be flushed. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
+/* Returns the length of the run of free sectors starting at
+   SECTOR, counting at most CNT sectors. */
+static size_t
+free_run_length (block_sector_t sector, size_t cnt)
+{
+  size_t len = 0;
+  while (len < cnt && sector + len < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + len))
+    len++;
+  return len;
+}
+
+/* Allocates a run of at most CNT contiguous sectors, preferably
+   starting at GOAL, and stores its first sector into *SECTORP.
+   If GOAL is 0 the search starts at the next-fit cursor instead.
+   A run of all CNT sectors is taken if one exists anywhere on
+   the disk; otherwise the first free run found is taken, however
+   short.  Returns the number of sectors allocated, 0 if the disk
+   is full.
+
+   The change is not written to disk until free_map_flush(). */
+size_t
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  size_t start, len;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  if (goal == 0 || goal >= bitmap_size (free_map))
+    goal = free_map_cursor;
+
+  /* Whole run, at GOAL or after it, then from the beginning. */
+  start = free_run_length (goal, cnt) == cnt
+          ? goal : bitmap_scan (free_map, goal, cnt, false);
+  if (start == BITMAP_ERROR)
+    start = bitmap_scan (free_map, 0, cnt, false);
+  len = cnt;
+
+  /* Otherwise the first partial run. */
+  if (start == BITMAP_ERROR)
+    {
+      start = bitmap_scan (free_map, goal, 1, false);
+      if (start == BITMAP_ERROR)
+        start = bitmap_scan (free_map, 0, 1, false);
+      len = start != BITMAP_ERROR ? free_run_length (start, cnt) : 0;
+    }
+
+  if (len > 0)
+    {
+      bitmap_set_multiple (free_map, start, len, true);
+      mark_dirty (start, len);
+      free_map_cursor = start + len < bitmap_size (free_map) ? start + len : 0;
+      *sectorp = start;
+    }
+  lock_release (&free_map_lock);
+  return len;
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+
+   The change is not written to disk until free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan_and_flip (free_map, free_map_cursor, cnt, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      mark_dirty (sector, cnt);
+      free_map_cursor = sector + cnt < bitmap_size (free_map) ? sector + cnt : 0;
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
   return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.
+   The change is not written to disk until free_map_flush(). */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file changed since the last
+   flush.  Each one is copied under free_map_lock and written with
+   the lock released, so that allocation does not wait for the
+   write.  Returns true if successful, false otherwise. */
+bool
+free_map_flush (void)
+{
+  bool success = true;
+  size_t i;
+
+  if (free_map_file == NULL)
+    return true;
+
+  lock_acquire (&free_map_flush_lock);
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+      size_t ofs = i * BLOCK_SECTOR_SIZE;
+      size_t size = 0;
+
+      lock_acquire (&free_map_lock);
+      if (bitmap_test (free_map_dirty, i))
+        {
+          size = bitmap_copy_part (free_map, free_map_buffer,
+                                   ofs, BLOCK_SECTOR_SIZE);
+          bitmap_reset (free_map_dirty, i);
+        }
+      lock_release (&free_map_lock);
+
+      if (size > 0
+          && (size_t) file_write_at (free_map_file, free_map_buffer,
+                                     size, ofs) != size)
+        {
+          lock_acquire (&free_map_lock);
+          bitmap_mark (free_map_dirty, i);
+          lock_release (&free_map_lock);
+          success = false;
+        }
+    }
+  lock_release (&free_map_flush_lock);
+  return success;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -64,6 +204,7 @@ free_map_open (void)
 void
 free_map_close (void) 
 {
+  free_map_flush ();
   file_close (free_map_file);
 }
 
@@ -82,4 +223,5 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
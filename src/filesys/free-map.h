@@ -12,6 +12,9 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_near (block_sector_t goal, size_t cnt,
+                               block_sector_t *);
 void free_map_release (block_sector_t, size_t);
+bool free_map_flush (void);
 
 #endif /* filesys/free-map.h */
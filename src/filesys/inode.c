@@ -10,13 +10,16 @@
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4f45   /* Inode with an extent map. */
 #define INVALID_SECTOR 0xffffffff
 
-bool check_indirect(InodeIndirect* indirect, int position) {
-	if (indirect->data[position] == 0){
-		return false;
-	}
-	return true;
+/* If true, inode_create() uses the extent format.
+   Chosen by "-extents" at format time, read back from the free map
+   inode otherwise. */
+bool inode_use_extents;
+
+static bool disk_has_extents(const struct inode_disk* disk) {
+	return disk->magic == INODE_EXTENT_MAGIC;
 }
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -25,14 +28,270 @@ static inline size_t bytes_to_sectors(off_t size) {
 	return DIV_ROUND_UP(size, BLOCK_SECTOR_SIZE);
 }
 
+/* Zeroes newly allocated SECTOR in the cache, without reading it
+   from disk.  FLAGS may add CACHE_META. */
+static void zero_sector(block_sector_t sector, int flags) {
+	struct cache* c = cache_get(sector, flags | CACHE_OVERWRITE);
+	memset(c->data, 0, BLOCK_SECTOR_SIZE);
+	cache_put(c);
+}
+
+/* Returns the sector holding file sector IDX of extent-format DISK,
+   or INVALID_SECTOR if the file has no such sector.  Past the
+   inode's own extents, the index block is binary searched for the
+   leaf covering IDX, so at most two blocks are read. */
+static block_sector_t extent_lookup(const struct inode_disk* disk, uint32_t idx) {
+	uint32_t cnt = disk->extent_cnt < INODE_EXTENT_NUM ? disk->extent_cnt : INODE_EXTENT_NUM;
+	uint32_t pos = idx;
+	for (uint32_t i = 0; i < cnt; i++) {
+		if (idx < disk->extents[i].length)
+			return disk->extents[i].start + idx;
+		idx -= disk->extents[i].length;
+	}
+	if (disk->extent_index == 0)
+		return INVALID_SECTOR;
+
+	/* Find the last leaf starting at or before POS. */
+	struct cache* c = cache_get(disk->extent_index, CACHE_META);
+	ExtentIndex* x = (ExtentIndex*)c->data;
+	block_sector_t leaf = 0;
+	uint32_t first = 0;
+	if (x->cnt > 0) {
+		uint32_t lo = 0, hi = x->cnt;
+		while (hi - lo > 1) {
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (x->leaves[mid].first <= pos)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		leaf = x->leaves[lo].sector;
+		first = x->leaves[lo].first;
+	}
+	cache_put(c);
+	if (leaf == 0 || pos < first)
+		return INVALID_SECTOR;
+
+	block_sector_t retval = INVALID_SECTOR;
+	idx = pos - first;
+	c = cache_get(leaf, CACHE_META);
+	ExtentBlock* b = (ExtentBlock*)c->data;
+	for (uint32_t i = 0; i < b->cnt && retval == INVALID_SECTOR; i++) {
+		if (idx < b->extents[i].length)
+			retval = b->extents[i].start + idx;
+		else
+			idx -= b->extents[i].length;
+	}
+	cache_put(c);
+	return retval;
+}
+
+/* Allocates a metadata sector for the extent tree of a file and
+   zeroes it in the cache, without reading it from disk. */
+static bool extent_alloc_block(block_sector_t* sector) {
+	if (!free_map_allocate(1, sector))
+		return false;
+	zero_sector(*sector, CACHE_META);
+	return true;
+}
+
+/* Appends the CNT sectors starting at START to the end of extent-format
+   DISK, merging them into the last extent when they continue it.
+   The caller adds CNT to DISK's sector count afterwards.
+   Returns false if a new extent block cannot be allocated or the
+   extent tree is full. */
+static bool extent_append(struct inode_disk* disk, block_sector_t start, uint32_t cnt) {
+	if (disk->extent_cnt <= INODE_EXTENT_NUM) {
+		struct extent* last = disk->extent_cnt > 0 ? &disk->extents[disk->extent_cnt - 1] : NULL;
+		if (last != NULL && last->start + last->length == start) {
+			last->length += cnt;
+			return true;
+		}
+		if (disk->extent_cnt < INODE_EXTENT_NUM) {
+			disk->extents[disk->extent_cnt].start = start;
+			disk->extents[disk->extent_cnt].length = cnt;
+			disk->extent_cnt++;
+			return true;
+		}
+	}
+
+	if (disk->extent_index == 0 && !extent_alloc_block(&disk->extent_index))
+		return false;
+
+	/* Find the last leaf block. */
+	struct cache* c = cache_get(disk->extent_index, CACHE_META);
+	uint32_t leaf_cnt = ((ExtentIndex*)c->data)->cnt;
+	block_sector_t leaf = leaf_cnt > 0 ? ((ExtentIndex*)c->data)->leaves[leaf_cnt - 1].sector : 0;
+	cache_put(c);
+
+	if (leaf != 0) {
+		c = cache_get(leaf, CACHE_META | CACHE_WRITE);
+		ExtentBlock* b = (ExtentBlock*)c->data;
+		bool done = false;
+		struct extent* last = b->cnt > 0 ? &b->extents[b->cnt - 1] : NULL;
+		if (last != NULL && last->start + last->length == start) {
+			last->length += cnt;
+			done = true;
+		}
+		else if (b->cnt < EXTENT_BLOCK_NUM) {
+			b->extents[b->cnt].start = start;
+			b->extents[b->cnt].length = cnt;
+			b->cnt++;
+			disk->extent_cnt++;
+			done = true;
+		}
+		cache_put(c);
+		if (done)
+			return true;
+	}
+	if (leaf_cnt == EXTENT_INDEX_NUM)
+		return false;
+
+	/* Start a new leaf block holding just this extent. */
+	block_sector_t sector;
+	if (!free_map_allocate(1, &sector))
+		return false;
+	c = cache_get(sector, CACHE_META | CACHE_OVERWRITE);
+	ExtentBlock* b = (ExtentBlock*)c->data;
+	memset(b, 0, BLOCK_SECTOR_SIZE);
+	b->cnt = 1;
+	b->extents[0].start = start;
+	b->extents[0].length = cnt;
+	cache_put(c);
+
+	c = cache_get(disk->extent_index, CACHE_META | CACHE_WRITE);
+	ExtentIndex* x = (ExtentIndex*)c->data;
+	x->leaves[x->cnt].first = disk->sector_cnt;
+	x->leaves[x->cnt].sector = sector;
+	x->cnt++;
+	cache_put(c);
+	disk->extent_cnt++;
+	return true;
+}
+
+/* Grows extent-format DISK to N allocated sectors, each zeroed.
+   Sectors are allocated in runs as long as the free map allows,
+   each placed right after the file's last sector if possible. */
+static bool extent_update(struct inode_disk* disk, uint32_t n) {
+	block_sector_t goal = 0;
+
+	if (disk->sector_cnt > 0)
+		goal = extent_lookup(disk, disk->sector_cnt - 1) + 1;
+	while (disk->sector_cnt < n) {
+		block_sector_t start;
+		uint32_t cnt = free_map_allocate_near(goal, n - disk->sector_cnt, &start);
+		if (cnt == 0)
+			return false;
+		goal = start + cnt;
+		if (!extent_append(disk, start, cnt)) {
+			free_map_release(start, cnt);
+			return false;
+		}
+		for (uint32_t i = 0; i < cnt; i++)
+			zero_sector(start + i, 0);
+		disk->sector_cnt += cnt;
+	}
+	return true;
+}
+
+/* Releases all sectors of extent-format DISK, including its extent
+   blocks. */
+static void extent_release(struct inode_disk* disk) {
+	uint32_t cnt = disk->extent_cnt < INODE_EXTENT_NUM ? disk->extent_cnt : INODE_EXTENT_NUM;
+	for (uint32_t i = 0; i < cnt; i++)
+		free_map_release(disk->extents[i].start, disk->extents[i].length);
+	if (disk->extent_index == 0)
+		return;
+
+	/* Walk the tree in place, pinning one block at a time, so that
+	   nothing is allocated and the release cannot stop halfway. */
+	for (uint32_t i = 0; ; i++) {
+		struct cache* c = cache_get(disk->extent_index, CACHE_META);
+		ExtentIndex* x = (ExtentIndex*)c->data;
+		block_sector_t leaf = i < x->cnt ? x->leaves[i].sector : 0;
+		cache_put(c);
+		if (leaf == 0)
+			break;
+
+		c = cache_get(leaf, CACHE_META);
+		ExtentBlock* b = (ExtentBlock*)c->data;
+		for (uint32_t j = 0; j < b->cnt; j++)
+			free_map_release(b->extents[j].start, b->extents[j].length);
+		cache_put(c);
+		free_map_release(leaf, 1);
+	}
+	free_map_release(disk->extent_index, 1);
+}
+
+/* Releases all sectors of indexed-format DATA, including its
+   indirect blocks. */
+static void indexed_release(struct inode_disk* data) {
+	for(int i = 0; i < DIRECT_BLOCK_NUM; i++) {
+		if(data->direct[i]) free_map_release(data->direct[i], 1);
+	}
+	if(data->double_indirect) {
+		// Walk both levels in place, pinning one block at a time.
+		for(int i = 0; i < INDIRECT_BLOCK_NUM; i++) {
+			struct cache* c = cache_get(data->double_indirect, CACHE_META);
+			block_sector_t indirect = ((InodeIndirect*)c->data)->data[i];
+			cache_put(c);
+			if(indirect == 0) continue;
+
+			c = cache_get(indirect, CACHE_META);
+			block_sector_t* sectors = ((InodeIndirect*)c->data)->data;
+			for(int j = 0; j < INDIRECT_BLOCK_NUM; j++) {
+				if(sectors[j]) free_map_release(sectors[j], 1);
+			}
+			cache_put(c);
+			free_map_release(indirect, 1);
+		}
+		free_map_release(data->double_indirect, 1);
+	}
+}
+
+/* In-memory copy of the part of an inode's block map that lives in
+   indirect blocks, so that byte_to_sector() touches the cache at most
+   once per indirect block (64 kB of file data). */
+struct inode_map {
+	bool indirect_valid;                         /* INDIRECT is loaded. */
+	block_sector_t indirect[INDIRECT_BLOCK_NUM]; /* The double-indirect block. */
+	int block_id;                                /* Indirect block in SECTORS, or -1. */
+	block_sector_t sectors[INDIRECT_BLOCK_NUM];  /* That indirect block. */
+};
+
+/* Returns INODE's block map cache, allocating it on first use.
+   Returns a null pointer if memory allocation fails. */
+static struct inode_map* inode_get_map(struct inode* inode) {
+	if (inode->map == NULL) {
+		inode->map = malloc(sizeof * inode->map);
+		if (inode->map != NULL) {
+			inode->map->indirect_valid = false;
+			inode->map->block_id = -1;
+		}
+	}
+	return inode->map;
+}
+
+/* Drops INODE's cached block map after its on-disk map changed. */
+static void inode_invalidate_map(struct inode* inode) {
+	if (inode->map != NULL) {
+		inode->map->indirect_valid = false;
+		inode->map->block_id = -1;
+	}
+}
 
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
-static block_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
+static block_sector_t byte_to_sector(struct inode* inode, off_t pos) {
 	ASSERT(inode != NULL);
 	int sector_position = pos / BLOCK_SECTOR_SIZE;
+	if (disk_has_extents(&inode->data)) {
+		block_sector_t sector = extent_lookup(&inode->data, sector_position);
+		check_sector(fs_device, sector);
+		return sector;
+	}
 	if (sector_position < DIRECT_BLOCK_NUM) {
 		// Direct block
 		block_sector_t sector = inode->data.direct[sector_position];
@@ -45,39 +304,100 @@ static block_sector_t byte_to_sector(const struct inode* inode, off_t pos) {
 	// Location (Block_ID, Sector_ID)
 	int indirect_block_ID = sector_position / INDIRECT_BLOCK_NUM,
 		indirect_sector_ID = sector_position % INDIRECT_BLOCK_NUM;
-	if (indirect_block_ID >= INDIRECT_BLOCK_NUM) {
+	if (indirect_block_ID >= INDIRECT_BLOCK_NUM || inode->data.double_indirect == 0) {
 		// Out of range
 		return INVALID_SECTOR;
 	}
 
-	// Get double indirect block
-	InodeIndirect* double_indirect = malloc(BLOCK_SECTOR_SIZE);
-	cache_read(inode->data.double_indirect, double_indirect, 0, BLOCK_SECTOR_SIZE);
-	if(!check_indirect(double_indirect, indirect_block_ID)) {
-		// Indirect block not allocated
-		free(double_indirect);
-		return INVALID_SECTOR;
+	block_sector_t indirect_sector, retval;
+	lock_acquire(&inode->map_lock);
+	struct inode_map* map = inode_get_map(inode);
+	if (map != NULL) {
+		// Serve both levels from the per-inode copy, loading what is missing.
+		if (!map->indirect_valid) {
+			cache_read_meta(inode->data.double_indirect, map->indirect, 0, BLOCK_SECTOR_SIZE);
+			map->indirect_valid = true;
+		}
+		indirect_sector = map->indirect[indirect_block_ID];
+		if (indirect_sector == 0) {
+			// Indirect block not allocated
+			lock_release(&inode->map_lock);
+			return INVALID_SECTOR;
+		}
+		if (map->block_id != indirect_block_ID) {
+			cache_read_meta(indirect_sector, map->sectors, 0, BLOCK_SECTOR_SIZE);
+			map->block_id = indirect_block_ID;
+		}
+		retval = map->sectors[indirect_sector_ID];
+		lock_release(&inode->map_lock);
 	}
-	// Get indirect block
-	InodeIndirect* indirect = malloc(BLOCK_SECTOR_SIZE);
-	cache_read(double_indirect->data[indirect_block_ID], indirect, 0, BLOCK_SECTOR_SIZE);
-	block_sector_t retval = INVALID_SECTOR;
-	if(check_indirect(indirect, indirect_sector_ID)) {
-		retval = indirect->data[indirect_sector_ID];
+	else {
+		lock_release(&inode->map_lock);
+		// Out of memory: look both levels up in place in the cache.
+		struct cache* c = cache_get(inode->data.double_indirect, CACHE_META);
+		indirect_sector = ((InodeIndirect*)c->data)->data[indirect_block_ID];
+		cache_put(c);
+		if (indirect_sector == 0) {
+			// Indirect block not allocated
+			return INVALID_SECTOR;
+		}
+		c = cache_get(indirect_sector, CACHE_META);
+		retval = ((InodeIndirect*)c->data)->data[indirect_sector_ID];
+		cache_put(c);
+	}
+	if (retval == 0) {
+		retval = INVALID_SECTOR;
 	}
 	check_sector(fs_device, retval);
-	free(double_indirect);
-	free(indirect);
 	return retval;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Returns true if INODE's data is file system metadata, that is,
+   a directory or the free map, which the cache keeps resident. */
+static bool inode_is_meta(const struct inode* inode) {
+	return inode->data.is_dir || inode->sector == FREE_MAP_SECTOR;
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt of every inode in it.
+   Never held across disk I/O. */
+static struct lock open_inodes_lock;
+
+static unsigned open_inodes_hash(const struct hash_elem* e, void* aux UNUSED) {
+	return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+static bool open_inodes_less(const struct hash_elem* a, const struct hash_elem* b,
+	void* aux UNUSED) {
+	return hash_entry(a, struct inode, elem)->sector
+		< hash_entry(b, struct inode, elem)->sector;
+}
 
 /* Initializes the inode module. */
 void inode_init(void) {
-	list_init(&open_inodes);
+	if (!hash_init(&open_inodes, open_inodes_hash, open_inodes_less, NULL))
+		PANIC("cannot allocate the open inode table");
+	lock_init(&open_inodes_lock);
+}
+
+/* Returns the open inode for SECTOR with its open count bumped,
+   or a null pointer if SECTOR is not open.
+   The caller must hold open_inodes_lock. */
+static struct inode* open_inodes_find(block_sector_t sector) {
+	struct inode key;
+	struct hash_elem* e;
+
+	key.sector = sector;
+	e = hash_find(&open_inodes, &key.elem);
+	if (e == NULL)
+		return NULL;
+
+	struct inode* inode = hash_entry(e, struct inode, elem);
+	inode->open_cnt++;
+	return inode;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -100,11 +420,12 @@ bool inode_create(block_sector_t sector, off_t length) {
 	{
 		size_t sectors = bytes_to_sectors(length);
 		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
+		disk_inode->magic = inode_use_extents ? INODE_EXTENT_MAGIC : INODE_MAGIC;
 		if (inode_update(disk_inode, sectors)) {
-			cache_write(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
+			cache_write_meta(sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
 			success = true;
 		}
+		free_map_flush();
 		free(disk_inode);
 	}
 	return success;
@@ -116,34 +437,46 @@ bool inode_create(block_sector_t sector, off_t length) {
 struct inode*
 	inode_open(block_sector_t sector)
 {
-	struct list_elem* e;
 	struct inode* inode;
+	struct inode* other;
 
 	/* Check whether this inode is already open. */
-	for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-		e = list_next(e))
-	{
-		inode = list_entry(e, struct inode, elem);
-		if (inode->sector == sector)
-		{
-			inode_reopen(inode);
-			return inode;
-		}
-	}
+	lock_acquire(&open_inodes_lock);
+	inode = open_inodes_find(sector);
+	lock_release(&open_inodes_lock);
+	if (inode != NULL)
+		return inode;
 
 	/* Allocate memory. */
 	inode = malloc(sizeof * inode);
 	if (inode == NULL)
 		return NULL;
 
-	/* Initialize. */
-	lock_init(&inode->lock);
-	list_push_front(&open_inodes, &inode->elem);
+	/* Initialize, reading the disk inode before the inode becomes
+	   visible to other openers. */
+	rwlock_init(&inode->rwlock);
+	lock_init(&inode->map_lock);
+	lock_init(&inode->dir_lock);
 	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	cache_read(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+	inode->read_end = 0;
+	inode->read_ahead_end = 0;
+	inode->map = NULL;
+	cache_read_meta(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+
+	/* Someone else may have opened the same sector meanwhile. */
+	lock_acquire(&open_inodes_lock);
+	other = open_inodes_find(sector);
+	if (other == NULL)
+		hash_insert(&open_inodes, &inode->elem);
+	lock_release(&open_inodes_lock);
+	if (other != NULL)
+	{
+		free(inode);
+		return other;
+	}
 	return inode;
 }
 
@@ -152,7 +485,11 @@ struct inode*
 	inode_reopen(struct inode* inode)
 {
 	if (inode != NULL)
+	{
+		lock_acquire(&open_inodes_lock);
 		inode->open_cnt++;
+		lock_release(&open_inodes_lock);
+	}
 	return inode;
 }
 
@@ -163,6 +500,18 @@ inode_get_inumber(const struct inode* inode)
 	return inode->sector;
 }
 
+/* Returns the number of openers of INODE. */
+int
+inode_open_cnt(const struct inode* inode)
+{
+	int open_cnt;
+
+	lock_acquire(&open_inodes_lock);
+	open_cnt = inode->open_cnt;
+	lock_release(&open_inodes_lock);
+	return open_cnt;
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -174,39 +523,28 @@ inode_close(struct inode* inode)
 		return;
 
 	/* Release resources if this was the last opener. */
-	if (--inode->open_cnt == 0)
-	{
-		/* Remove from inode list and release lock. */
-		list_remove(&inode->elem);
+	lock_acquire(&open_inodes_lock);
+	bool last = --inode->open_cnt == 0;
+	if (last)
+		hash_delete(&open_inodes, &inode->elem);
+	lock_release(&open_inodes_lock);
 
+	if (last)
+	{
 		/* Deallocate blocks if removed. */
 		if (inode->removed)
 		{
 			free_map_release(inode->sector, 1);
 			
 			// Free all blocks with garbage collection
-			InodeDisk* data = &inode->data;
-			for(int i = 0; i < DIRECT_BLOCK_NUM; i++) {
-				if(data->direct[i]) free_map_release(data->direct[i], 1);
-			}
-			InodeIndirect double_indirect;
-			if(data->double_indirect) {
-				cache_read(data->double_indirect, &double_indirect, 0, BLOCK_SECTOR_SIZE);
-				for(int i = 0; i < INDIRECT_BLOCK_NUM; i++) {
-					if(double_indirect.data[i]) {
-						InodeIndirect indirect;
-						cache_read(double_indirect.data[i], &indirect, 0, BLOCK_SECTOR_SIZE);
-						for(int j = 0; j < INDIRECT_BLOCK_NUM; j++) {
-							if(indirect.data[j]) free_map_release(indirect.data[j], 1);
-						}
-						free_map_release(double_indirect.data[i], 1);
-					}
-				}
-				free_map_release(data->double_indirect, 1);
-			}
-
+			if (disk_has_extents(&inode->data))
+				extent_release(&inode->data);
+			else
+				indexed_release(&inode->data);
+			free_map_flush();
 		}
 
+		free(inode->map);
 		free(inode);
 	}
 }
@@ -226,14 +564,14 @@ inode_remove(struct inode* inode)
 off_t
 inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset)
 {
-	lock_acquire(&inode->lock);
+	rwlock_acquire_read(&inode->rwlock);
 	uint8_t* buffer = buffer_;
 	off_t bytes_read = 0;
 	uint8_t* bounce = NULL;
 
 	// Check Size
 	if(offset > inode->data.length) {
-		lock_release(&inode->lock);
+		rwlock_release_read(&inode->rwlock);
 		return 0;
 	}
 	if(offset + size > inode->data.length) {
@@ -256,7 +594,10 @@ inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset)
 		if (chunk_size <= 0)
 			break;
 
-		cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+		if (inode_is_meta(inode))
+			cache_read_meta(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+		else
+			cache_read(sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
@@ -265,7 +606,26 @@ inode_read_at(struct inode* inode, void* buffer_, off_t size, off_t offset)
 	}
 	//free(bounce);
 
-	lock_release(&inode->lock);
+	// Sequential reader: queue the next sectors so that the disk
+	// works on them while the caller copies this chunk out.
+	off_t pos = 0, end = 0;
+	lock_acquire(&inode->map_lock);
+	if (bytes_read > 0 && offset - bytes_read == inode->read_end) {
+		pos = ROUND_UP(offset, BLOCK_SECTOR_SIZE);
+		end = pos + READ_AHEAD_WINDOW * BLOCK_SECTOR_SIZE;
+		if (pos < inode->read_ahead_end)
+			pos = inode->read_ahead_end;
+		if (end > inode_length(inode))
+			end = inode_length(inode);
+		if (end > inode->read_ahead_end)
+			inode->read_ahead_end = end;
+	}
+	inode->read_end = offset;
+	lock_release(&inode->map_lock);
+	for (; pos < end; pos += BLOCK_SECTOR_SIZE)
+		read_ahead(byte_to_sector(inode, pos));
+
+	rwlock_release_read(&inode->rwlock);
 	return bytes_read;
 }
 
@@ -282,20 +642,24 @@ inode_write_at(struct inode* inode, const void* buffer_, off_t size,
 	off_t bytes_written = 0;
 	uint8_t* bounce = NULL;
 
-	if (inode->deny_write_cnt)
+	rwlock_acquire_write(&inode->rwlock);
+	if (inode->deny_write_cnt) {
+		rwlock_release_write(&inode->rwlock);
 		return 0;
-
-	lock_acquire(&inode->lock);
+	}
 
 	// Check for if we need to extend inode
 	if (offset + size > inode->data.length) {
 		int sectors = bytes_to_sectors(offset + size);
-		if (!inode_update(&inode->data, sectors)) {
-			lock_release(&inode->lock);
+		bool success = inode_update(&inode->data, sectors);
+		free_map_flush();
+		inode_invalidate_map(inode);
+		if (!success) {
+			rwlock_release_write(&inode->rwlock);
 			return 0;
 		}
 		inode->data.length = offset + size;
-		cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+		cache_write_meta(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
 	}
 
 	while (size > 0)
@@ -316,7 +680,10 @@ inode_write_at(struct inode* inode, const void* buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
-		cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+		if (inode_is_meta(inode))
+			cache_write_meta(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
+		else
+			cache_write(sector_idx, buffer + bytes_written, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
@@ -324,7 +691,7 @@ inode_write_at(struct inode* inode, const void* buffer_, off_t size,
 		bytes_written += chunk_size;
 	}
 	free(bounce);
-	lock_release(&inode->lock);
+	rwlock_release_write(&inode->rwlock);
 	return bytes_written;
 }
 
@@ -333,8 +700,10 @@ inode_write_at(struct inode* inode, const void* buffer_, off_t size,
 void
 inode_deny_write(struct inode* inode)
 {
+	rwlock_acquire_write(&inode->rwlock);
 	inode->deny_write_cnt++;
 	ASSERT(inode->deny_write_cnt <= inode->open_cnt);
+	rwlock_release_write(&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -343,9 +712,11 @@ inode_deny_write(struct inode* inode)
 void
 inode_allow_write(struct inode* inode)
 {
+	rwlock_acquire_write(&inode->rwlock);
 	ASSERT(inode->deny_write_cnt > 0);
 	ASSERT(inode->deny_write_cnt <= inode->open_cnt);
 	inode->deny_write_cnt--;
+	rwlock_release_write(&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -355,94 +726,145 @@ inode_length(const struct inode* inode)
 	return inode->data.length;
 }
 
+/* Returns true if INODE's block map is in the extent format. */
+bool inode_has_extents(const struct inode* inode) {
+	return disk_has_extents(&inode->data);
+}
+
 bool inode_is_dir(const struct inode* inode) {
 	return inode->data.is_dir;
 }
 
-void inode_set_dir(struct inode* inode, bool is_dir) {
-	inode->data.is_dir = is_dir;
-	cache_write(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+/* Returns the format INODE was created with by dir_create(), or 0 if
+   it is not a directory. */
+unsigned inode_dir_format(const struct inode* inode) {
+	return inode->data.is_dir;
+}
+
+void inode_set_dir(struct inode* inode, unsigned format) {
+	inode->data.is_dir = format;
+	cache_write_meta(inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
 }
 
-bool alloc_inode_block(block_sector_t* sector) {
-	static uint8_t zeros[BLOCK_SECTOR_SIZE];
+/* Allocates and zeroes *SECTOR unless it is already allocated,
+   preferring the sector at *GOAL.  Either way *GOAL is advanced to
+   the sector after *SECTOR, so consecutive calls lay blocks out
+   contiguously. */
+bool alloc_inode_block(block_sector_t* sector, block_sector_t* goal) {
 	if (*sector == 0) {
-		if (!free_map_allocate(1, sector)) {
+		if (free_map_allocate_near(*goal, 1, sector) == 0) {
 			return false;
 		}
-		cache_write(*sector, zeros, 0, BLOCK_SECTOR_SIZE);
+		zero_sector(*sector, 0);
+	}
+	*goal = *sector + 1;
+	return true;
+}
+
+/* Allocates and zeroes a block of an indexed inode's block map,
+   preferring the sector at *GOAL, and advances *GOAL past it. */
+static bool alloc_map_block(block_sector_t* sector, block_sector_t* goal) {
+	if (free_map_allocate_near(*goal, 1, sector) == 0) {
+		return false;
 	}
+	zero_sector(*sector, CACHE_META);
+	*goal = *sector + 1;
 	return true;
 }
 
+/* Makes sure the first CNT entries of indirect block SECTOR point
+   to allocated, zeroed data sectors.  The block is pinned only to
+   find the next run of missing entries and to record the sectors
+   allocated for it; they are zeroed in between, since no other
+   cache call may be made while it is pinned. */
+static bool indirect_update(block_sector_t sector, int cnt, block_sector_t* goal) {
+	int j = 0;
+	while (j < cnt) {
+		struct cache* c = cache_get(sector, CACHE_META);
+		block_sector_t* data = ((InodeIndirect*)c->data)->data;
+		int k;
+		for(; j < cnt && data[j] != 0; j++) {
+			*goal = data[j] + 1;
+		}
+		for(k = j; k < cnt && data[k] == 0; k++) {
+			continue;
+		}
+		cache_put(c);
+		if (j == cnt) {
+			break;
+		}
+
+		block_sector_t start;
+		size_t run = free_map_allocate_near(*goal, k - j, &start);
+		if (run == 0) {
+			return false;
+		}
+		for(size_t r = 0; r < run; r++) {
+			zero_sector(start + r, 0);
+		}
+		c = cache_get(sector, CACHE_META | CACHE_WRITE);
+		data = ((InodeIndirect*)c->data)->data;
+		for(size_t r = 0; r < run; r++) {
+			data[j + r] = start + r;
+		}
+		cache_put(c);
+		j += run;
+		*goal = start + run;
+	}
+	return true;
+}
+
+/* Makes sure the first N data sectors of INODE are allocated,
+   allocating and zeroing the missing ones.  The block map is
+   updated in place in the cache. */
 bool inode_update(InodeDisk* inode, int n) {
+	if (disk_has_extents(inode)) {
+		return extent_update(inode, n);
+	}
+	block_sector_t goal = 0;
 	int direct_cnt = (n <= DIRECT_BLOCK_NUM) ? n : DIRECT_BLOCK_NUM;
 	n -= direct_cnt;
 
 	// Allocate direct blocks first
 	for(int i = 0; i < direct_cnt; i++) {
-		if (!alloc_inode_block(&inode->direct[i])) {
+		if (!alloc_inode_block(&inode->direct[i], &goal)) {
 			return false;
 		}
 	}
 	if (n == 0) {
 		return true;
 	}
-	// If there are still blocks to allocate, allocate indirect block
-	int indirect_cnt;
-	if (n % INDIRECT_BLOCK_NUM != 0) {
-		indirect_cnt = n / INDIRECT_BLOCK_NUM + 1;
-	}
-	else {
-		indirect_cnt = n / INDIRECT_BLOCK_NUM;
-	}
 
 	// Double indirect block
-	InodeIndirect* double_indirect = malloc(BLOCK_SECTOR_SIZE);
 	if (inode->double_indirect == 0) {
-		// Means double indirect block not allocated
-		if(!alloc_inode_block(&inode->double_indirect)) {
-			free(double_indirect);
+		if (!alloc_map_block(&inode->double_indirect, &goal)) {
 			return false;
 		}
-		// Initialize double indirect block
-		memset(double_indirect, 0, BLOCK_SECTOR_SIZE);
 	}
 	else {
-		cache_read(inode->double_indirect, double_indirect, 0, BLOCK_SECTOR_SIZE);
+		goal = inode->double_indirect + 1;
 	}
 
-	// Allocate indirect blocks
+	// Allocate indirect blocks, then their data sectors
+	int indirect_cnt = DIV_ROUND_UP(n, INDIRECT_BLOCK_NUM);
 	for(int i = 0; i < indirect_cnt; i++) {
 		int cnt = (n <= INDIRECT_BLOCK_NUM) ? n : INDIRECT_BLOCK_NUM;
 		n -= cnt;
 
-		// Allocate indirect block
-		InodeIndirect* indirect = malloc(BLOCK_SECTOR_SIZE);
-		block_sector_t* indirect_sector = &double_indirect->data[i];
-
-		if (*indirect_sector == 0) {
-			if(!alloc_inode_block(indirect_sector)) {
-				free(double_indirect);
-				free(indirect);
+		struct cache* c = cache_get(inode->double_indirect, CACHE_META);
+		block_sector_t indirect = ((InodeIndirect*)c->data)->data[i];
+		cache_put(c);
+		if (indirect == 0) {
+			if (!alloc_map_block(&indirect, &goal)) {
 				return false;
 			}
-			memset(indirect, 0, BLOCK_SECTOR_SIZE);
+			c = cache_get(inode->double_indirect, CACHE_META | CACHE_WRITE);
+			((InodeIndirect*)c->data)->data[i] = indirect;
+			cache_put(c);
 		}
-		else {
-			cache_read(*indirect_sector, indirect, 0, BLOCK_SECTOR_SIZE);
-		}
-		for(int j = 0; j < cnt; j++) {
-			if(!alloc_inode_block(&indirect->data[j])) {
-				free(double_indirect);
-				free(indirect);
-				return false;
-			}
+		if (!indirect_update(indirect, cnt, &goal)) {
+			return false;
 		}
-		cache_write(*indirect_sector, indirect, 0, BLOCK_SECTOR_SIZE);
-		free(indirect);
 	}
-	cache_write(inode->double_indirect, double_indirect, 0, BLOCK_SECTOR_SIZE);
-	free(double_indirect);
 	return true;
 }
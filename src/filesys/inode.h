@@ -2,37 +2,90 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
-#include <list.h>
+#include <hash.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 #include "threads/synch.h"
 
 struct bitmap;
+struct inode_map;
 #define DIRECT_BLOCK_NUM 124
 #define INDIRECT_BLOCK_NUM 128
+#define INODE_EXTENT_NUM 61 // Extents stored in the inode itself
+#define EXTENT_BLOCK_NUM 63 // Extents stored in each extent leaf block
+#define EXTENT_INDEX_NUM 63 // Leaf blocks listed in the extent index block
+
+/* A run of LENGTH contiguous sectors starting at START. */
+struct extent
+{
+	block_sector_t start;
+	uint32_t length;
+};
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   The block map has one of two formats, told apart by MAGIC: an
+   indexed map of direct and double-indirect pointers, or a list of
+   extents that continues in a two-level tree of extent blocks. */
 typedef struct inode_disk
 {
 	off_t length;                       /* File size in bytes. */
-	unsigned is_dir; // 1 if this inode is a directory, 0 if not
+	unsigned is_dir; // Directory format (DIR_FORMAT_*) if a directory, 0 if not
     unsigned magic;                     /* Magic number. */
-	block_sector_t direct[DIRECT_BLOCK_NUM]; // 124 direct blocks
-    block_sector_t double_indirect; // 1 double-indirect block
+	union {
+		struct { // INODE_MAGIC
+			block_sector_t direct[DIRECT_BLOCK_NUM]; // 124 direct blocks
+			block_sector_t double_indirect; // 1 double-indirect block
+		};
+		struct { // INODE_EXTENT_MAGIC
+			uint32_t sector_cnt; // Sectors allocated to the file
+			uint32_t extent_cnt; // Extents in the inode and its extent blocks
+			block_sector_t extent_index; // Extent index block, or 0
+			struct extent extents[INODE_EXTENT_NUM]; // First extents, in file order
+		};
+	};
 } InodeDisk;
 
+/* Leaf block of an extent-format inode's overflow tree, holding
+   extents that follow those in the inode, in file order.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+typedef struct extent_block
+{
+	uint32_t cnt; // Extents used in this block
+	uint32_t unused;
+	struct extent extents[EXTENT_BLOCK_NUM];
+} ExtentBlock;
+
+/* Root of an extent-format inode's overflow tree: its leaf blocks
+   in file order, each with the file sector its first extent
+   starts at, so that a lookup reads one index and one leaf block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+typedef struct extent_index
+{
+	uint32_t cnt; // Leaf blocks used
+	uint32_t unused;
+	struct {
+		uint32_t first; // File sector at which the leaf starts
+		block_sector_t sector; // The leaf block
+	} leaves[EXTENT_INDEX_NUM];
+} ExtentIndex;
+
 
 /* In-memory inode. */
 typedef struct inode
 {
-	struct list_elem elem;              /* Element in inode list. */
+	struct hash_elem elem;              /* Element in open_inodes. */
 	block_sector_t sector;              /* Sector number of disk location. */
-	int open_cnt;                       /* Number of openers. */
+	int open_cnt;                       /* Number of openers, under open_inodes_lock. */
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
-    struct lock lock; // Lock for inode
+    struct rwlock rwlock; // Held shared by readers, exclusive by writers
+    struct lock map_lock; // Protects map, read_end and read_ahead_end
+    struct lock dir_lock; // Serializes lookups and changes to a directory's entries
+    off_t read_end; // Offset just past the last read, to detect sequential reads
+    off_t read_ahead_end; // Offset up to which sectors have been queued for prefetch
+    struct inode_map* map; // Cached block map beyond the direct blocks, or NULL
 } Inode;
 
 typedef struct indirect_inode
@@ -46,6 +99,7 @@ bool inode_create (block_sector_t, off_t);
 Inode *inode_open (block_sector_t);
 Inode *inode_reopen (Inode *);
 block_sector_t inode_get_inumber (const Inode *);
+int inode_open_cnt (const Inode *);
 void inode_close (Inode *);
 void inode_remove (Inode *);
 off_t inode_read_at (Inode *, void *, off_t size, off_t offset);
@@ -54,9 +108,14 @@ void inode_deny_write (Inode *);
 void inode_allow_write (Inode *);
 off_t inode_length (const Inode *);
 
+/* If true, inode_create() uses the extent format. */
+extern bool inode_use_extents;
+
 /* For Project 4 */
 bool inode_is_dir(const Inode*);
-void inode_set_dir(Inode*, bool);
-bool alloc_inode_block(block_sector_t*);
+bool inode_has_extents(const Inode*);
+unsigned inode_dir_format(const Inode*);
+void inode_set_dir(Inode*, unsigned format);
+bool alloc_inode_block(block_sector_t*, block_sector_t*);
 bool inode_update(InodeDisk* , off_t);
 #endif /* filesys/inode.h */
@@ -3,6 +3,8 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,11 +25,19 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   On top of the bits sits one summary level with a bit per
+   element: FULL marks elements whose bits are all 1, EMPTY those
+   whose bits are all 0.  Searches use them to skip ELEM_BITS
+   elements at a time, so scanning a mostly full or mostly empty
+   bitmap costs one step per ELEM_BITS * ELEM_BITS bits. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Summary: element of BITS is all 1s. */
+    elem_type *empty;   /* Summary: element of BITS is all 0s. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +70,42 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for BIT_CNT bits and
+   their summary. */
+static inline size_t
+storage_size (size_t bit_cnt)
+{
+  return sizeof (elem_type) * (elem_cnt (bit_cnt)
+                               + 2 * elem_cnt (elem_cnt (bit_cnt)));
+}
+
+/* Returns the number of bits in X that are 1. */
+static inline unsigned
+popcount (elem_type x)
+{
+  x = x - ((x >> 1) & 0x55555555);
+  x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+  x = (x + (x >> 4)) & 0x0f0f0f0f;
+  return (x * 0x01010101) >> 24;
+}
+
+/* Returns the index of the lowest 1 bit in X, which must not be
+   0.  Compiles to a single BSF instruction. */
+static inline unsigned
+lowest_bit (elem_type x)
+{
+  return __builtin_ctzl (x);
+}
+
+/* Returns a mask of the N bits starting at bit OFS of an element,
+   where OFS + N <= ELEM_BITS. */
+static inline elem_type
+range_mask (size_t ofs, size_t n)
+{
+  elem_type bits = n < ELEM_BITS ? ((elem_type) 1 << n) - 1 : (elem_type) -1;
+  return bits << ofs;
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -69,6 +115,50 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Brings the summary bits of element IDX of B up to date.
+   The caller must keep interrupts off from its update of the
+   element through this call, so that the element and its summary
+   bits change together. */
+static inline void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type word = b->bits[idx];
+  size_t sum_idx = elem_idx (idx);
+  elem_type mask = bit_mask (idx);
+
+  if (word == (elem_type) -1)
+    b->full[sum_idx] |= mask;
+  else
+    b->full[sum_idx] &= ~mask;
+  if (word == 0)
+    b->empty[sum_idx] |= mask;
+  else
+    b->empty[sum_idx] &= ~mask;
+}
+
+/* Recomputes all of B's summary bits. */
+static void
+rebuild_summary (struct bitmap *b)
+{
+  size_t i;
+
+  for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+    update_summary (b, i);
+}
+
+/* Points B's arrays into the storage at BITS, sized for BIT_CNT
+   bits, and clears every bit. */
+static void
+init_storage (struct bitmap *b, size_t bit_cnt, elem_type *bits)
+{
+  b->bit_cnt = bit_cnt;
+  b->bits = bits;
+  b->full = bits + elem_cnt (bit_cnt);
+  b->empty = b->full + elem_cnt (elem_cnt (bit_cnt));
+  memset (bits, 0, storage_size (bit_cnt));
+  rebuild_summary (b);
+}
+
 /* Creation and destruction. */
 
 /* Creates and returns a pointer to a newly allocated bitmap with room for
@@ -81,11 +171,10 @@ bitmap_create (size_t bit_cnt)
   struct bitmap *b = malloc (sizeof *b);
   if (b != NULL)
     {
-      b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
-      if (b->bits != NULL || bit_cnt == 0)
+      elem_type *bits = malloc (storage_size (bit_cnt));
+      if (bits != NULL || bit_cnt == 0)
         {
-          bitmap_set_all (b, false);
+          init_storage (b, bit_cnt, bits);
           return b;
         }
       free (b);
@@ -103,9 +192,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
   
   ASSERT (block_size >= bitmap_buf_size (bit_cnt));
 
-  b->bit_cnt = bit_cnt;
-  b->bits = (elem_type *) (b + 1);
-  bitmap_set_all (b, false);
+  init_storage (b, bit_cnt, (elem_type *) (b + 1));
   return b;
 }
 
@@ -114,7 +201,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + storage_size (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -158,11 +245,16 @@ bitmap_mark (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level;
 
   /* This is equivalent to `b->bits[idx] |= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
+     the description of the OR instruction in [IA32-v2b].  Interrupts are
+     turned off so that the summary is updated atomically with it. */
+  old_level = intr_disable ();
   asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -171,11 +263,16 @@ bitmap_reset (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level;
 
   /* This is equivalent to `b->bits[idx] &= ~mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
+     the description of the AND instruction in [IA32-v2a].  Interrupts are
+     turned off so that the summary is updated atomically with it. */
+  old_level = intr_disable ();
   asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -186,11 +283,16 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
 {
   size_t idx = elem_idx (bit_idx);
   elem_type mask = bit_mask (bit_idx);
+  enum intr_level old_level;
 
   /* This is equivalent to `b->bits[idx] ^= mask' except that it
      is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the XOR instruction in [IA32-v2b]. */
+     the description of the XOR instruction in [IA32-v2b].  Interrupts are
+     turned off so that the summary is updated atomically with it. */
+  old_level = intr_disable ();
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
+  intr_set_level (old_level);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -213,18 +315,80 @@ bitmap_set_all (struct bitmap *b, bool value)
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element, together with its summary bits, is updated
+   atomically, but the range as a whole is not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t i, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  for (i = start, end = start + cnt; i < end; )
+    {
+      size_t idx = elem_idx (i);
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+      elem_type mask = range_mask (ofs, n);
+      enum intr_level old_level;
+
+      /* See bitmap_mark() and bitmap_reset(). */
+      old_level = intr_disable ();
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      update_summary (b, idx);
+      intr_set_level (old_level);
+      i += n;
+    }
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Whole elements that cannot contain VALUE are skipped using the
+   summary, ELEM_BITS of them at a time where possible. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  const elem_type *skip = value ? b->empty : b->full;
+  elem_type flip = value ? 0 : (elem_type) -1;
+  size_t idx, last_idx;
+  elem_type word;
+
+  if (start >= end)
+    return end;
+
+  /* Bits of the first element, from START on. */
+  idx = elem_idx (start);
+  word = (b->bits[idx] ^ flip) & ((elem_type) -1 << (start % ELEM_BITS));
+
+  last_idx = elem_idx (end - 1);
+  while (word == 0)
+    {
+      /* Find the next element that may hold VALUE. */
+      elem_type sum;
+      if (++idx > last_idx)
+        return end;
+      sum = ~skip[elem_idx (idx)] & ((elem_type) -1 << (idx % ELEM_BITS));
+      while (sum == 0)
+        {
+          idx = (elem_idx (idx) + 1) * ELEM_BITS;
+          if (idx > last_idx)
+            return end;
+          sum = ~skip[elem_idx (idx)];
+        }
+      idx = elem_idx (idx) * ELEM_BITS + lowest_bit (sum);
+      if (idx > last_idx)
+        return end;
+      word = b->bits[idx] ^ flip;
+    }
+
+  start = idx * ELEM_BITS + lowest_bit (word);
+  return start < end ? start : end;
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +396,21 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t i, end, value_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  for (i = start, end = start + cnt; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = ELEM_BITS - ofs < end - i ? ELEM_BITS - ofs : end - i;
+      value_cnt += popcount (b->bits[elem_idx (i)] & range_mask (ofs, n));
+      i += n;
+    }
+  return value ? value_cnt : cnt - value_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,16 +418,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -298,13 +461,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+
+  /* Jump from each run of VALUE bits to the end of the run,
+     until one is long enough. */
+  while (cnt <= b->bit_cnt - start) 
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t first = find_next (b, start, b->bit_cnt, value);
+      size_t stop;
+      if (cnt > b->bit_cnt - first)
+        break;
+      stop = find_next (b, first, first + cnt, !value);
+      if (stop == first + cnt)
+        return first;
+      start = stop;
     }
   return BITMAP_ERROR;
 }
@@ -346,6 +517,7 @@ bitmap_read (struct bitmap *b, struct file *file)
       off_t size = byte_cnt (b->bit_cnt);
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      rebuild_summary (b);
     }
   return success;
 }
@@ -358,6 +530,22 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Copies the SIZE bytes starting at byte OFS of B's file image
+   into DST, clipped to the end of B, so that they can be written
+   to the same offset in a file later.  Returns the number of
+   bytes copied. */
+size_t
+bitmap_copy_part (const struct bitmap *b, void *dst, size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  if (ofs >= file_size)
+    return 0;
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  memcpy (dst, (const uint8_t *) b->bits + ofs, size);
+  return size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -34,8 +34,16 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/inode.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -64,6 +72,9 @@ static char **read_command_line(void);
 static char **parse_options(char **argv);
 static void run_actions(char **argv);
 static void usage(void);
+#ifdef FILESYS
+static size_t parse_cache_size(const char *value);
+#endif
 
 #ifdef FILESYS
 static void locate_block_devices(void);
@@ -125,6 +136,11 @@ int main(void)
 	locate_block_devices();
 	filesys_init(format_filesys);
 #endif
+#ifdef VM
+	/* Initialize virtual memory. */
+	frame_init();
+	swap_init();
+#endif
 
 	printf("Boot complete.\n");
 
@@ -242,13 +258,26 @@ parse_options(char **argv)
 #ifdef FILESYS
 		else if (!strcmp(name, "-f"))
 			format_filesys = true;
+		else if (!strcmp(name, "-extents"))
+			inode_use_extents = true;
+		else if (!strcmp(name, "-hashdir"))
+			dir_use_hash = true;
 		else if (!strcmp(name, "-filesys"))
 			filesys_bdev_name = value;
 		else if (!strcmp(name, "-scratch"))
 			scratch_bdev_name = value;
+		else if (!strcmp(name, "-cache"))
+			cache_size = parse_cache_size(value);
+		else if (!strcmp(name, "-cache-policy"))
+		{
+			if (value == NULL || !cache_set_policy(value))
+				PANIC("unknown cache policy `%s' (use -h for help)", value);
+		}
 #ifdef VM
 		else if (!strcmp(name, "-swap"))
 			swap_bdev_name = value;
+		else if (!strcmp(name, "-stk"))
+			stack_page_limit = atoi(value);
 #endif
 #endif
 		else if (!strcmp(name, "-rs"))
@@ -369,10 +398,15 @@ usage(void)
 		   "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
 		   "  -f                 Format file system device during startup.\n"
+		   "  -extents           With -f, use extent-based inodes.\n"
+		   "  -hashdir           With -f, use hashed directories.\n"
 		   "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
 		   "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+		   "  -cache=N[%%]       Cache N sectors, or N%% of RAM, for the file system.\n"
+		   "  -cache-policy=P    Use cache replacement policy P (clock, 2q).\n"
 #ifdef VM
 		   "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+		   "  -stk=COUNT         Limit user stacks to COUNT pages.\n"
 #endif
 #endif
 		   "  -rs=SEED           Set random number seed to SEED.\n"
@@ -385,6 +419,21 @@ usage(void)
 }
 
 #ifdef FILESYS
+/* Parses the argument of "-cache": either a number of sectors or,
+   with a trailing "%", a percentage of physical memory. */
+static size_t
+parse_cache_size(const char *value)
+{
+	size_t n;
+
+	if (value == NULL)
+		PANIC("-cache requires an argument (use -h for help)");
+	n = atoi(value);
+	if (strchr(value, '%') != NULL)
+		n = (size_t) init_ram_pages * (PGSIZE / BLOCK_SECTOR_SIZE) * n / 100;
+	return n;
+}
+
 /* Figure out what block devices to cast in the various Pintos roles. */
 static void
 locate_block_devices(void)
@@ -32,6 +32,19 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 
+/* Longest chain of locks that a priority donation follows, so
+   that a long or circular chain of waiters cannot stall us. */
+#define DONATION_DEPTH 8
+
+/* Orders threads in a waiters list by priority. */
+static bool
+thread_priority_less(const struct list_elem *a, const struct list_elem *b,
+					 void *aux UNUSED)
+{
+	return list_entry(a, struct thread, elem)->priority
+		   < list_entry(b, struct thread, elem)->priority;
+}
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -99,7 +112,8 @@ bool sema_try_down(struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any, the longest waiting one among equals.
 
    This function may be called from an interrupt handler. */
 void sema_up(struct semaphore *sema)
@@ -110,10 +124,16 @@ void sema_up(struct semaphore *sema)
 
 	old_level = intr_disable();
 	if (!list_empty(&sema->waiters))
-		thread_unblock(list_entry(list_pop_front(&sema->waiters),
-								  struct thread, elem));
+	{
+		struct list_elem *e = list_max(&sema->waiters,
+									   thread_priority_less, NULL);
+		list_remove(e);
+		thread_unblock(list_entry(e, struct thread, elem));
+	}
 	sema->value++;
 	intr_set_level(old_level);
+	if (old_level == INTR_ON || intr_context())
+		thread_preempt();
 }
 
 static void sema_test_helper(void *sema_);
@@ -172,25 +192,86 @@ void lock_init(struct lock *lock)
 	ASSERT(lock != NULL);
 
 	lock->holder = NULL;
+	lock->max_priority = PRI_MIN;
 	sema_init(&lock->semaphore, 1);
 }
 
+/* Donates thread T's priority along the chain of locks starting
+   with the one T waits for: to that lock's holder, to the holder
+   of the lock that holder waits for, and so on, for at most
+   DONATION_DEPTH locks.  Interrupts must be off. */
+static void
+donate_priority(struct thread *t)
+{
+	struct lock *l = t->waiting_lock;
+	int depth;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	for (depth = 0; l != NULL && depth < DONATION_DEPTH; depth++)
+	{
+		if (t->priority <= l->max_priority)
+			break;
+		l->max_priority = t->priority;
+		if (l->holder == NULL)
+			break;
+		thread_update_priority(l->holder);
+		t = l->holder;
+		l = t->waiting_lock;
+	}
+}
+
+/* Makes thread T, which just took LOCK's semaphore, its holder.
+   The waiters left behind go on donating through LOCK.
+   Interrupts must be off. */
+static void
+lock_grant(struct lock *lock, struct thread *t)
+{
+	struct list *waiters = &lock->semaphore.waiters;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	lock->holder = t;
+	lock->max_priority = PRI_MIN;
+	if (!list_empty(waiters) && !thread_mlfqs)
+		lock->max_priority = list_entry(list_max(waiters, thread_priority_less, NULL),
+										struct thread, elem)->priority;
+	list_push_back(&t->locks, &lock->elem);
+	thread_update_priority(t);
+}
+
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the current thread donates its priority to the
+   holder of LOCK, and through it along the chain of locks the
+   holder itself waits for.  The multi-level feedback queue
+   scheduler does not use donation.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
    we need to sleep. */
 void lock_acquire(struct lock *lock)
 {
+	struct thread *cur = thread_current();
+	enum intr_level old_level;
+
 	ASSERT(lock != NULL);
 	ASSERT(!intr_context());
 	ASSERT(!lock_held_by_current_thread(lock));
 
+	old_level = intr_disable();
+	if (lock->holder != NULL && !thread_mlfqs)
+	{
+		cur->waiting_lock = lock;
+		donate_priority(cur);
+	}
 	sema_down(&lock->semaphore);
-	lock->holder = thread_current();
+	cur->waiting_lock = NULL;
+	lock_grant(lock, cur);
+	intr_set_level(old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -201,29 +282,43 @@ void lock_acquire(struct lock *lock)
    interrupt handler. */
 bool lock_try_acquire(struct lock *lock)
 {
+	enum intr_level old_level;
 	bool success;
 
 	ASSERT(lock != NULL);
 	ASSERT(!lock_held_by_current_thread(lock));
 
+	old_level = intr_disable();
 	success = sema_try_down(&lock->semaphore);
 	if (success)
-		lock->holder = thread_current();
+		lock_grant(lock, thread_current());
+	intr_set_level(old_level);
 	return success;
 }
 
 /* Releases LOCK, which must be owned by the current thread.
+   Priority donated through LOCK is given up, which may make the
+   current thread yield.
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
    handler. */
 void lock_release(struct lock *lock)
 {
+	enum intr_level old_level;
+
 	ASSERT(lock != NULL);
 	ASSERT(lock_held_by_current_thread(lock));
 
+	old_level = intr_disable();
+	list_remove(&lock->elem);
 	lock->holder = NULL;
+	lock->max_priority = PRI_MIN;
+	thread_update_priority(thread_current());
 	sema_up(&lock->semaphore);
+	intr_set_level(old_level);
+	if (old_level == INTR_ON)
+		thread_preempt();
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -236,13 +331,112 @@ bool lock_held_by_current_thread(const struct lock *lock)
 	return lock->holder == thread_current();
 }
 
+/* Initializes RW.  A readers-writer lock may be held by any
+   number of readers at once, or by a single writer.
+
+   Writers are preferred: once a writer is waiting, new readers
+   wait until it is done, so a steady stream of readers cannot
+   starve it.  This falls out of the construction: a writer holds
+   RW's `writer' lock from the time it starts waiting until it is
+   done, and readers pass through that lock on their way in.
+   Readers and writers waiting for `writer' therefore donate their
+   priority to the writer.  A writer waiting for readers to leave
+   does not donate to them, because readers do not own RW.
+
+   Like locks, readers-writer locks are not recursive: a thread
+   that holds RW in either mode must not acquire it again. */
+void rwlock_init(struct rwlock *rw)
+{
+	ASSERT(rw != NULL);
+
+	lock_init(&rw->writer);
+	rw->readers = 0;
+	sema_init(&rw->drained, 0);
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or is
+   waiting for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rwlock_acquire_read(struct rwlock *rw)
+{
+	enum intr_level old_level;
+
+	ASSERT(rw != NULL);
+	ASSERT(!intr_context());
+
+	lock_acquire(&rw->writer);
+	old_level = intr_disable();
+	rw->readers++;
+	intr_set_level(old_level);
+	lock_release(&rw->writer);
+}
+
+/* Releases RW, which the current thread must hold for reading.
+   The last reader to leave lets a waiting writer in. */
+void rwlock_release_read(struct rwlock *rw)
+{
+	enum intr_level old_level;
+	bool wake;
+
+	ASSERT(rw != NULL);
+
+	old_level = intr_disable();
+	ASSERT(rw->readers > 0);
+	wake = --rw->readers == 0 && !list_empty(&rw->drained.waiters);
+	intr_set_level(old_level);
+
+	/* No reader can enter meanwhile: the waiting writer holds
+	   `writer'. */
+	if (wake)
+		sema_up(&rw->drained);
+}
+
+/* Acquires RW for writing, sleeping until no other writer holds it
+   and the readers inside have left.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void rwlock_acquire_write(struct rwlock *rw)
+{
+	enum intr_level old_level;
+
+	ASSERT(rw != NULL);
+	ASSERT(!intr_context());
+
+	lock_acquire(&rw->writer);
+	old_level = intr_disable();
+	while (rw->readers > 0)
+		sema_down(&rw->drained);
+	intr_set_level(old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void rwlock_release_write(struct rwlock *rw)
+{
+	ASSERT(rw != NULL);
+
+	lock_release(&rw->writer);
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem
 {
 	struct list_elem elem;		/* List element. */
 	struct semaphore semaphore; /* This semaphore. */
+	struct thread *thread;		/* Thread waiting on it. */
 };
 
+/* Orders the waiters of a condition variable by priority. */
+static bool
+waiter_priority_less(const struct list_elem *a, const struct list_elem *b,
+					 void *aux UNUSED)
+{
+	return list_entry(a, struct semaphore_elem, elem)->thread->priority
+		   < list_entry(b, struct semaphore_elem, elem)->thread->priority;
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -283,6 +477,7 @@ void cond_wait(struct condition *cond, struct lock *lock)
 	ASSERT(lock_held_by_current_thread(lock));
 
 	sema_init(&waiter.semaphore, 0);
+	waiter.thread = thread_current();
 	list_push_back(&cond->waiters, &waiter.elem);
 	lock_release(lock);
 	sema_down(&waiter.semaphore);
@@ -290,7 +485,8 @@ void cond_wait(struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the one with the highest priority to
+   wake up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -304,9 +500,12 @@ void cond_signal(struct condition *cond, struct lock *lock UNUSED)
 	ASSERT(lock_held_by_current_thread(lock));
 
 	if (!list_empty(&cond->waiters))
-		sema_up(&list_entry(list_pop_front(&cond->waiters),
-							struct semaphore_elem, elem)
-					 ->semaphore);
+	{
+		struct list_elem *e = list_max(&cond->waiters,
+									   waiter_priority_less, NULL);
+		list_remove(e);
+		sema_up(&list_entry(e, struct semaphore_elem, elem)->semaphore);
+	}
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
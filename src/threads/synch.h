@@ -22,6 +22,8 @@ struct lock
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+    struct list_elem elem;      /* Element in holder's `locks' list. */
+    int max_priority;           /* Highest priority donated by a waiter. */
   };
 
 void lock_init (struct lock *);
@@ -30,6 +32,20 @@ bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
 
+/* Readers-writer lock. */
+struct rwlock 
+  {
+    struct lock writer;         /* Held by the writer, or one about to be. */
+    unsigned readers;           /* Number of readers inside. */
+    struct semaphore drained;   /* Writer waits here for readers to leave. */
+  };
+
+void rwlock_init (struct rwlock *);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+
 /* Condition variable. */
 struct condition 
   {
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
@@ -21,9 +22,14 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-   /* List of processes in THREAD_READY state, that is, processes
-	  that are ready to run but not actually running. */
-static struct list ready_list;
+   /* Processes in THREAD_READY state, that is, processes that are
+	  ready to run but not actually running, with one FIFO queue per
+	  priority.  Bit P of ready_mask is set iff ready_queues[P] is
+	  not empty, so the highest ready priority is found with a
+	  single bit scan. */
+static struct list ready_queues[PRI_MAX + 1];
+static uint64_t ready_mask;
+static int ready_cnt;           /* # of threads in ready_queues. */
 
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
@@ -60,14 +66,11 @@ static unsigned thread_ticks;   /* # of timer ticks since last yield. */
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
-/* Project 2 */
-static struct lock file_lock;
-void acquire_file_lock(){
-	lock_acquire(&file_lock);
-}
-void release_file_lock(){
-	lock_release(&file_lock);
-}
+/* Multi-level feedback queue scheduler.
+   Only the running thread's recent_cpu and priority change from
+   tick to tick; every thread is recomputed once per second. */
+static fixed_t load_avg;        /* Average # of threads ready to run. */
+
 
 static void kernel_thread(thread_func*, void* aux);
 
@@ -75,6 +78,12 @@ static void idle(void* aux UNUSED);
 static struct thread* running_thread(void);
 static struct thread* next_thread_to_run(void);
 static void init_thread(struct thread*, const char* name, int priority);
+static void ready_push(struct thread*);
+static void ready_remove(struct thread*);
+static void mlfqs_update_priority(struct thread*, void* aux);
+static void mlfqs_update_recent_cpu(struct thread*, void* aux);
+static void mlfqs_second(void);
+static int ready_max_priority(void);
 static bool is_thread(struct thread*) UNUSED;
 static void* alloc_frame(struct thread*, size_t size);
 static void schedule(void);
@@ -100,8 +109,11 @@ thread_init(void)
 	ASSERT(intr_get_level() == INTR_OFF);
 
 	lock_init(&tid_lock);
-	lock_init(&file_lock);
-	list_init(&ready_list);
+	for (int i = PRI_MIN; i <= PRI_MAX; i++)
+		list_init(&ready_queues[i]);
+	ready_mask = 0;
+	ready_cnt = 0;
+	load_avg = 0;
 	list_init(&all_list);
 
 	/* Set up a thread structure for the running thread. */
@@ -145,6 +157,15 @@ thread_tick(void)
 	else
 		kernel_ticks++;
 
+	if (thread_mlfqs) {
+		if (t != idle_thread)
+			t->recent_cpu = fp_add_int(t->recent_cpu, 1);
+		if (timer_ticks() % TIMER_FREQ == 0)
+			mlfqs_second();
+		else if (timer_ticks() % TIME_SLICE == 0)
+			mlfqs_update_priority(t, NULL);
+	}
+
 	/* Enforce preemption. */
 	if (++thread_ticks >= TIME_SLICE)
 		intr_yield_on_return();
@@ -170,9 +191,8 @@ thread_print_stats(void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   If PRIORITY is higher than the running thread's, the new thread
+   preempts it. */
 tid_t thread_create(const char* name, int priority, thread_func* function, void* aux) {
 	struct thread* t;
 	struct kernel_thread_frame* kf;
@@ -240,10 +260,12 @@ void thread_block(void) {
    This is an error if T is not blocked.  (Use thread_yield() to
    make the running thread ready.)
 
-   This function does not preempt the running thread.  This can
-   be important: if the caller had disabled interrupts itself,
-   it may expect that it can atomically unblock a thread and
-   update other data. */
+   If T has a higher priority than the running thread, the running
+   thread is preempted, but only if interrupts were on or this is
+   an interrupt handler.  This can be important: if the caller had
+   disabled interrupts itself, it may expect that it can atomically
+   unblock a thread and update other data.  Such callers should call
+   thread_preempt() once they turn interrupts back on. */
 void thread_unblock(struct thread* t) {
 	enum intr_level old_level;
 
@@ -251,9 +273,28 @@ void thread_unblock(struct thread* t) {
 
 	old_level = intr_disable();
 	ASSERT(t->status == THREAD_BLOCKED);
-	list_push_back(&ready_list, &t->elem);
+	ready_push(t);
 	t->status = THREAD_READY;
 	intr_set_level(old_level);
+	if (old_level == INTR_ON || intr_context())
+		thread_preempt();
+}
+
+/* Yields the CPU if a ready thread has a higher priority than the
+   running thread.  In an interrupt handler, yields on return from
+   the interrupt instead. */
+void thread_preempt(void) {
+	enum intr_level old_level = intr_disable();
+	bool preempt = idle_thread != NULL
+		&& ready_max_priority() > thread_current()->priority;
+	intr_set_level(old_level);
+
+	if (preempt) {
+		if (intr_context())
+			intr_yield_on_return();
+		else
+			thread_yield();
+	}
 }
 
 /* Returns the name of the running thread. */
@@ -306,9 +347,7 @@ thread_exit(void) {
 	while(!list_empty(file_list)){
 		e = list_pop_front(file_list);
 		struct thread_node* thread_node = list_entry(e, struct thread_node, elem);
-		acquire_file_lock();
 		file_close(thread_node->file);
-		release_file_lock();
 		
 		list_remove(e);
 		free(thread_node);
@@ -335,7 +374,7 @@ thread_yield(void)
 
 	old_level = intr_disable();
 	if (cur != idle_thread)
-		list_push_back(&ready_list, &cur->elem);
+		ready_push(cur);
 	cur->status = THREAD_READY;
 	schedule();
 	intr_set_level(old_level);
@@ -358,11 +397,55 @@ thread_foreach(thread_action_func* func, void* aux)
 	}
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's base priority to NEW_PRIORITY,
+   yielding if it no longer has the highest priority.  Priority
+   donated to the thread stays in effect until it releases the
+   locks it was donated through.
+
+   Ignored by the multi-level feedback queue scheduler, which
+   sets priorities itself. */
 void
 thread_set_priority(int new_priority)
 {
-	thread_current()->priority = new_priority;
+	struct thread* cur = thread_current();
+	enum intr_level old_level;
+
+	ASSERT(PRI_MIN <= new_priority && new_priority <= PRI_MAX);
+	if (thread_mlfqs)
+		return;
+
+	old_level = intr_disable();
+	cur->base_priority = new_priority;
+	thread_update_priority(cur);
+	intr_set_level(old_level);
+	thread_preempt();
+}
+
+/* Recomputes T's priority as the highest of its base priority and
+   the priorities donated through the locks it holds, moving T to
+   its new run queue if it is ready.  Interrupts must be off. */
+void
+thread_update_priority(struct thread* t)
+{
+	int priority = t->base_priority;
+	struct list_elem* e;
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	for (e = list_begin(&t->locks); e != list_end(&t->locks); e = list_next(e)) {
+		struct lock* l = list_entry(e, struct lock, elem);
+		if (l->max_priority > priority)
+			priority = l->max_priority;
+	}
+	if (priority == t->priority)
+		return;
+	if (t->status == THREAD_READY) {
+		ready_remove(t);
+		t->priority = priority;
+		ready_push(t);
+	}
+	else
+		t->priority = priority;
 }
 
 /* Returns the current thread's priority. */
@@ -372,35 +455,98 @@ thread_get_priority(void)
 	return thread_current()->priority;
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* Sets the current thread's nice value to NICE and recomputes its
+   priority, yielding if it no longer has the highest priority. */
 void
-thread_set_nice(int nice UNUSED)
+thread_set_nice(int nice)
 {
-	/* Not yet implemented. */
+	enum intr_level old_level;
+
+	ASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+
+	old_level = intr_disable();
+	thread_current()->nice = nice;
+	if (thread_mlfqs)
+		mlfqs_update_priority(thread_current(), NULL);
+	intr_set_level(old_level);
+	thread_preempt();
 }
 
 /* Returns the current thread's nice value. */
 int
 thread_get_nice(void)
 {
-	/* Not yet implemented. */
-	return 0;
+	return thread_current()->nice;
 }
 
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg(void)
 {
-	/* Not yet implemented. */
-	return 0;
+	enum intr_level old_level = intr_disable();
+	int load = fp_round(load_avg * 100);
+	intr_set_level(old_level);
+	return load;
 }
 
 /* Returns 100 times the current thread's recent_cpu value. */
 int
 thread_get_recent_cpu(void)
 {
-	/* Not yet implemented. */
-	return 0;
+	enum intr_level old_level = intr_disable();
+	int recent_cpu = fp_round(thread_current()->recent_cpu * 100);
+	intr_set_level(old_level);
+	return recent_cpu;
+}
+
+/* Sets T's priority from its recent_cpu and nice values:
+   PRI_MAX - recent_cpu / 4 - nice * 2, rounded down and clamped
+   to the valid range.  Interrupts must be off.  Usable with
+   thread_foreach(). */
+static void
+mlfqs_update_priority(struct thread* t, void* aux UNUSED)
+{
+	int priority = fp_trunc(fp_from_int(PRI_MAX - t->nice * 2) - t->recent_cpu / 4);
+
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	if (t == idle_thread)
+		return;
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	else if (priority > PRI_MAX)
+		priority = PRI_MAX;
+	t->base_priority = priority;
+	thread_update_priority(t);
+}
+
+/* Decays T's recent_cpu by the current load average.  AUX points
+   to the decay coefficient, 2 * load_avg / (2 * load_avg + 1).
+   Interrupts must be off.  Usable with thread_foreach(). */
+static void
+mlfqs_update_recent_cpu(struct thread* t, void* aux)
+{
+	fixed_t coef = *(fixed_t*)aux;
+
+	if (t == idle_thread)
+		return;
+	t->recent_cpu = fp_add_int(fp_mul(coef, t->recent_cpu), t->nice);
+	mlfqs_update_priority(t, NULL);
+}
+
+/* Once-per-second update of the load average and of every thread's
+   recent_cpu and priority.  Runs in the timer interrupt. */
+static void
+mlfqs_second(void)
+{
+	int ready_threads = ready_cnt + (thread_current() != idle_thread);
+	fixed_t coef;
+
+	load_avg = (59 * load_avg + fp_from_int(ready_threads)) / 60;
+	coef = fp_div(2 * load_avg, fp_add_int(2 * load_avg, 1));
+	thread_foreach(mlfqs_update_recent_cpu, &coef);
+	if (ready_max_priority() > thread_current()->priority)
+		intr_yield_on_return();
 }
 
 /* Idle thread.  Executes when no other thread is ready to run.
@@ -425,6 +571,9 @@ idle(void* idle_started_ UNUSED)
 		intr_disable();
 		thread_block();
 
+		/* Skip timer interrupts until the next timeout is due. */
+		timer_idle_enter();
+
 		/* Re-enable interrupts and wait for the next one.
 
 		   The `sti' instruction disables interrupts until the
@@ -438,6 +587,7 @@ idle(void* idle_started_ UNUSED)
 		   See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
 		   7.11.1 "HLT Instruction". */
 		asm volatile ("sti; hlt" : : : "memory");
+		timer_idle_exit();
 	}
 }
 
@@ -488,7 +638,20 @@ init_thread(struct thread* t, const char* name, int priority) {
 	strlcpy(t->name, name, sizeof t->name);
 	t->stack = (uint8_t*)t + PGSIZE;
 	t->priority = priority;
+	t->base_priority = priority;
+	list_init(&t->locks);
+	t->waiting_lock = NULL;
 	t->magic = THREAD_MAGIC;
+	if (t != initial_thread) {
+		/* Inherit the scheduling state of the creating thread. */
+		t->nice = thread_current()->nice;
+		t->recent_cpu = thread_current()->recent_cpu;
+	}
+	if (thread_mlfqs) {
+		old_level = intr_disable();
+		mlfqs_update_priority(t, NULL);
+		intr_set_level(old_level);
+	}
 #ifdef USERPROG
 	/* Project 2.2 */
 	if(t == initial_thread) t->parent = NULL;
@@ -500,6 +663,11 @@ init_thread(struct thread* t, const char* name, int priority) {
 	t->exit_code = -1;//UINT32_MAX;
 	t->self_fd = 2;
 	t->file_opened = NULL;
+#endif
+#ifdef VM
+	t->user_esp = NULL;
+	list_init(&t->mappings);
+	t->next_mapid = 1;
 #endif
 	old_level = intr_disable();
 	list_push_back(&all_list, &t->allelem);
@@ -517,18 +685,58 @@ static void* alloc_frame(struct thread* t, size_t size) {
 	return t->stack;
 }
 
+/* Adds ready thread T to the back of its priority's run queue.
+   Interrupts must be off. */
+static void ready_push(struct thread* t) {
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	list_push_back(&ready_queues[t->priority], &t->elem);
+	ready_mask |= (uint64_t)1 << t->priority;
+	ready_cnt++;
+}
+
+/* Removes ready thread T from its run queue.  Interrupts must be
+   off. */
+static void ready_remove(struct thread* t) {
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	list_remove(&t->elem);
+	if (list_empty(&ready_queues[t->priority]))
+		ready_mask &= ~((uint64_t)1 << t->priority);
+	ready_cnt--;
+}
+
+/* Returns the highest priority of any ready thread, or -1 if no
+   thread is ready.  Interrupts must be off. */
+static int ready_max_priority(void) {
+	ASSERT(intr_get_level() == INTR_OFF);
+
+	return ready_mask != 0 ? 63 - __builtin_clzll(ready_mask) : -1;
+}
+
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   idle_thread.
+
+   The thread is taken from the front of the highest non-empty
+   priority queue, so threads of equal priority run round-robin. */
 static struct thread*
 next_thread_to_run(void)
 {
-	if (list_empty(&ready_list))
+	int priority = ready_max_priority();
+	struct list* queue;
+	struct thread* t;
+
+	if (priority < 0)
 		return idle_thread;
-	else
-		return list_entry(list_pop_front(&ready_list), struct thread, elem);
+	queue = &ready_queues[priority];
+	t = list_entry(list_pop_front(queue), struct thread, elem);
+	if (list_empty(queue))
+		ready_mask &= ~((uint64_t)1 << priority);
+	ready_cnt--;
+	return t;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -558,6 +766,12 @@ void thread_schedule_tail(struct thread* prev) {
 	/* Start new time slice. */
 	thread_ticks = 0;
 
+	/* An interrupt that woke a thread while idle was halted yields
+	   to it before idle resumes, so restore the periodic tick here
+	   rather than leave the woken thread without timer interrupts. */
+	if (prev != NULL && prev == idle_thread)
+		timer_idle_exit();
+
 #ifdef USERPROG
 	/* Activate the new address space. */
 	process_activate();
@@ -2,9 +2,11 @@
 #define THREADS_THREAD_H
 
 #include <debug.h>
+#include <hash.h>
 #include <list.h>
 #include <stdint.h>
 #include "threads/synch.h"
+#include "threads/fixed-point.h"
 #include "filesys/directory.h"
 
 /* States in a thread's life cycle. */
@@ -26,6 +28,11 @@ typedef int tid_t;
 #define PRI_DEFAULT 31                  /* Default priority. */
 #define PRI_MAX 63                      /* Highest priority. */
 
+/* Thread niceness, for the multi-level feedback queue scheduler. */
+#define NICE_MIN -20                    /* Nicest to other threads. */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Least nice. */
+
 /* Initialize Macro for Project 2 */
 // Thread Macro for Project 2
 #define THREAD_TICKS_TO_UNBLOCK_NO_TICKS (-1)
@@ -112,9 +119,18 @@ struct thread {
 	enum thread_status status;          /* Thread state. */
 	char name[16];                      /* Name (for debugging purposes). */
 	uint8_t* stack;                     /* Saved stack pointer. */
-	int priority;                       /* Priority. */
+	int priority;                       /* Priority, including donations. */
 	struct list_elem allelem;           /* List element for all threads list. */
 
+	/* Shared between thread.c and synch.c. */
+	int base_priority;                  /* Priority before donations. */
+	struct list locks;                  /* Locks held, which waiters donate to. */
+	struct lock* waiting_lock;          /* Lock being waited for, or NULL. */
+
+	/* Owned by thread.c, for the multi-level feedback queue scheduler. */
+	int nice;                           /* Niceness. */
+	fixed_t recent_cpu;                 /* Recently used CPU time. */
+
 	/* Shared between thread.c and synch.c. */
 	struct list_elem elem;              /* List element. */
 
@@ -137,6 +153,15 @@ struct thread {
 	int self_fd; // file descriptor
 	struct list file_list; // List of files
 	struct file* file_opened; // File opened by thread
+#endif
+#ifdef VM
+	/* Owned by vm/page.c. */
+	struct hash pages;                  /* Supplemental page table. */
+	void* user_esp;                     /* User esp on entry to a system call. */
+
+	/* Owned by vm/mmap.c. */
+	struct list mappings;               /* Memory-mapped files. */
+	int next_mapid;                     /* Identifier of the next mapping. */
 #endif
 	/* Structure for Project 4 */
 	struct dir* cwd;
@@ -161,6 +186,8 @@ tid_t thread_create(const char* name, int priority, thread_func*, void*);
 
 void thread_block(void);
 void thread_unblock(struct thread*);
+void thread_preempt(void);
+void thread_update_priority(struct thread*);
 
 struct thread* thread_current(void);
 tid_t thread_tid(void);
@@ -183,7 +210,4 @@ int thread_get_load_avg(void);
 
 struct thread_link* thread_get_child(int);
 struct thread* get_thread(int);
-
-void acquire_file_lock(void);
-void release_file_lock(void);
 #endif /* threads/thread.h */
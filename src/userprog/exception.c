@@ -4,6 +4,10 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef VM
+#include "threads/vaddr.h"
+#include "vm/page.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -147,6 +151,20 @@ page_fault (struct intr_frame *f)
   not_present = (f->error_code & PF_P) == 0;
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
+
+#ifdef VM
+  /* A page of the process that has not been brought in yet,
+     touched either by the process or by the kernel on its behalf.
+     Load it, or grow the stack to cover it, and retry the access.
+     In the kernel, f->esp is the kernel stack pointer, so use the
+     one the process had when it made the system call. */
+  if (not_present && is_user_vaddr (fault_addr))
+    {
+      void *esp = user ? f->esp : thread_current ()->user_esp;
+      if (page_load (fault_addr) || page_grow_stack (fault_addr, esp))
+        return;
+    }
+#endif
    if (!user) {
       f->eip = f->eax;
       f->eax = -1;
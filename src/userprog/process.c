@@ -17,6 +17,10 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static thread_func start_process NO_RETURN;
 static bool load(const char *cmdline, void (**eip)(void), void **esp);
@@ -131,6 +135,11 @@ void process_exit(void) {
 	   to the kernel-only page directory. */
 	pd = cur->pagedir;
 	if (pd != NULL) {
+#ifdef VM
+		/* Write back mapped files while the page directory still
+		   records which of their pages are dirty. */
+		mmap_unmap_all();
+#endif
 		/* Correct ordering here is crucial.  We must set
 		   cur->pagedir to NULL before switching page directories,
 		   so that a timer interrupt can't switch back to the
@@ -140,6 +149,9 @@ void process_exit(void) {
 		   that's been freed (and cleared). */
 		cur->pagedir = NULL;
 		pagedir_activate(NULL);
+#ifdef VM
+		page_table_destroy(pd);
+#endif
 		pagedir_destroy(pd);
 	}
 }
@@ -240,13 +252,20 @@ bool load(const char *command, void (**eip)(void), void **esp) {
 	int i;
 
 	/* Allocate and activate page directory. */
+#ifdef VM
+	if (!page_table_init())
+		goto done;
+#endif
 	t->pagedir = pagedir_create();
-	if (t->pagedir == NULL)
+	if (t->pagedir == NULL) {
+#ifdef VM
+		page_table_destroy(NULL);
+#endif
 		goto done;
+	}
 	process_activate();
 
 	// Get Executable Name
-	acquire_file_lock();
 	char *save_ptr, *exe_name = malloc(strlen(command) + 1);
 	strlcpy(exe_name, command, strlen(command) + 1);
 	exe_name = strtok_r(exe_name, " ", &save_ptr);
@@ -337,7 +356,6 @@ bool load(const char *command, void (**eip)(void), void **esp) {
 
 done:
 	/* We arrive here whether the load is successful or not. */
-	release_file_lock();
 	return success;
 }
 
@@ -372,12 +390,23 @@ static bool push_arguments_to_stack(void** esp, const char* argument_string){
 }
 /* load() helpers. */
 
+#ifndef VM
 static bool install_page(void *upage, void *kpage, bool writable);
+#endif
 
 /* Create a minimal stack by mapping a zeroed page at the top of
    user virtual memory. */
 // static bool setup_stack(void **esp, const char *command)
 static bool setup_stack(void **esp, const char* command) {
+#ifdef VM
+	/* The stack page is an ordinary zero page, brought in now to
+	   hold the arguments. */
+	uint8_t *upage = ((uint8_t *)PHYS_BASE) - PGSIZE;
+	if (!page_add_zero(upage, true) || !page_load(upage))
+		return false;
+	*esp = PHYS_BASE;
+	return push_arguments_to_stack(esp, command);
+#else
 	uint8_t *kpage;
 	bool success = false;
 
@@ -393,6 +422,7 @@ static bool setup_stack(void **esp, const char* command) {
 			palloc_free_page(kpage);
 	}
 	return success;
+#endif
 }
 
 /* Checks whether PHDR describes a valid, loadable segment in
@@ -462,6 +492,25 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT(pg_ofs(upage) == 0);
 	ASSERT(ofs % PGSIZE == 0);
 
+#ifdef VM
+	/* Record each page, to be read in when first touched. */
+	while (read_bytes > 0 || zero_bytes > 0)
+	{
+		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+		bool success = page_read_bytes > 0
+			? page_add_file(upage, file, ofs, page_read_bytes, writable)
+			: page_add_zero(upage, writable);
+		if (!success)
+			return false;
+
+		read_bytes -= page_read_bytes;
+		zero_bytes -= page_zero_bytes;
+		ofs += page_read_bytes;
+		upage += PGSIZE;
+	}
+	return true;
+#else
 	file_seek(file, ofs);
 	while (read_bytes > 0 || zero_bytes > 0)
 	{
@@ -497,10 +546,12 @@ load_segment(struct file *file, off_t ofs, uint8_t *upage,
 		upage += PGSIZE;
 	}
 	return true;
+#endif
 }
 
 
 
+#ifndef VM
 /* Adds a mapping from user virtual address UPAGE to kernel
    virtual address KPAGE to the page table.
    If WRITABLE is true, the user process may modify the page;
@@ -517,3 +568,4 @@ static bool install_page(void *upage, void *kpage, bool writable) {
 	   address, then map our page there. */
 	return (pagedir_get_page(t->pagedir, upage) == NULL && pagedir_set_page(t->pagedir, upage, kpage, writable));
 }
+#endif
@@ -8,6 +8,10 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#ifdef VM
+#include "vm/mmap.h"
+#include "vm/page.h"
+#endif
 
 static void syscall_handler(struct intr_frame*);
 
@@ -98,18 +102,14 @@ int syscall_wait(int pid){
 // Create
 bool syscall_create(const char* file, unsigned initial_size){
 	check_string(file);
-	acquire_file_lock();
 	bool ret_val = filesys_create(file, initial_size);
-	release_file_lock();
 	return ret_val;
 }
 
 // Remove
 bool syscall_remove(const char* file){
 	check_string(file);
-	acquire_file_lock();
 	bool ret_val = filesys_remove(file);
-	release_file_lock();
 	return ret_val;
 }
 
@@ -151,9 +151,7 @@ int syscall_filesize(int fd){
 	struct thread_node* thread_node = get_file(thread_current(), fd);
 	
 	if(thread_node){
-		acquire_file_lock();
 		int file_len = file_length(thread_node->file);
-		release_file_lock();
 		return file_len;
 	}
 	else{
@@ -180,9 +178,13 @@ int syscall_read(int fd, uint8_t* buffer, unsigned length){
 		
 		if(thread_node){
 			if(thread_node->is_dir) return -1;
-			acquire_file_lock();
+#ifdef VM
+			if(!page_pin(buffer, length, true)) exit_special();
+#endif
 			ret_val = file_read(thread_node->file, buffer, length);
-			release_file_lock();
+#ifdef VM
+			page_unpin(buffer, length);
+#endif
 			return ret_val;
 		}
 		else return -1;
@@ -204,9 +206,13 @@ int syscall_write(int fd, const void* buffer, unsigned length){
 		struct thread_node* thread_node = get_file(thread_current(), fd);
 		if(thread_node){
 			if(thread_node->is_dir) return -1;
-			acquire_file_lock();
+#ifdef VM
+			if(!page_pin(buffer, length, false)) exit_special();
+#endif
 			ret_val = file_write(thread_node->file, buffer, length);
-			release_file_lock();
+#ifdef VM
+			page_unpin(buffer, length);
+#endif
 		}
 		return ret_val;
 	}
@@ -219,9 +225,7 @@ void syscall_seek(int fd, unsigned int position){
 	struct list_elem* e;
 	struct thread_node* thread_node = get_file(thread_current(), fd);
 	if(thread_node){
-		acquire_file_lock();
 		file_seek(thread_node->file, position);
-		release_file_lock();
 	}
 	else{
 		exit_special();
@@ -234,9 +238,7 @@ unsigned syscall_tell(int fd){
 	struct list_elem* e;
 	struct thread_node* thread_node = get_file(thread_current(), fd);
 	if(thread_node){
-		acquire_file_lock();
 		unsigned retval = file_tell(thread_node->file);
-		release_file_lock();
 		return retval;
 	}	
 	else{
@@ -251,10 +253,8 @@ void syscall_close(int fd){
 	struct list_elem* e;
 	struct thread_node* thread_node = get_file(thread_current(), fd);
 	if(thread_node){	
-		acquire_file_lock();
 		if(thread_node->is_dir) dir_close(thread_node->dir);
 		else file_close(thread_node->file);
-		release_file_lock();
 
 		list_remove(&thread_node->elem);
 		free(thread_node);
@@ -264,22 +264,33 @@ void syscall_close(int fd){
 	}
 }
 
+#ifdef VM
+// Mmap
+static int syscall_mmap(int fd, void* addr){
+	struct thread_node* thread_node = get_file(thread_current(), fd);
+	if(thread_node == NULL || thread_node->file_descriptor != fd
+		|| thread_node->is_dir) return -1;
+	return mmap_map(thread_node->file, addr);
+}
+
+// Munmap
+static void syscall_munmap(int mapid){
+	mmap_unmap(mapid);
+}
+#endif
+
 /* Project 4 */
 // Chdir
 bool syscall_chdir(const char* dir) {
 	check_string(dir);
-	acquire_file_lock();
 	bool flag = filesys_chdir(dir);
-	release_file_lock();
 	return flag;
 }
 
 // Mkdir
 bool syscall_mkdir(const char* dir) {
 	check_string(dir);
-	acquire_file_lock();
 	bool flag = filesys_mkdir(dir);
-	release_file_lock();
 	return flag;
 }
 
@@ -360,6 +371,14 @@ void syscall_init(void){
 	syscall_argc[SYS_CLOSE] = 1;
 	syscall_func[SYS_CLOSE] = (void*)syscall_close;
 
+#ifdef VM
+	syscall_argc[SYS_MMAP] = 2;
+	syscall_func[SYS_MMAP] = (void*)syscall_mmap;
+
+	syscall_argc[SYS_MUNMAP] = 1;
+	syscall_func[SYS_MUNMAP] = (void*)syscall_munmap;
+#endif
+
 
 
 	/* Project 4 */
@@ -381,6 +400,10 @@ void syscall_init(void){
 
 static void syscall_handler(struct intr_frame* f){
 	int* user_pointer = f->esp;
+#ifdef VM
+	/* Saved for stack growth on faults in the kernel. */
+	thread_current()->user_esp = f->esp;
+#endif
 	check_pt(user_pointer + 1);
 
 	int sys_code = *(int*)user_pointer;
@@ -0,0 +1,315 @@
+#include "vm/frame.h"
+#include <debug.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Frames of the user pool in use, as a clock ring: the front of
+   the list is the clock hand. */
+static struct list frame_table;
+
+/* Shared frames, keyed by the file contents they hold. */
+static struct hash shared_frames;
+
+/* Protects frame_table, shared_frames, pin counts and the
+   sharers of shared frames.  Never held across I/O. */
+static struct lock frame_lock;
+
+/* A page mapping a shared frame. */
+struct sharer
+{
+	struct page* page;                  /* Page mapping the frame. */
+	uint32_t* pagedir;                  /* Page directory mapping PAGE. */
+	struct list_elem elem;              /* Element in the frame's sharers. */
+};
+
+static unsigned frame_hash(const struct hash_elem* e, void* aux UNUSED) {
+	const struct frame* f = hash_entry(e, struct frame, hash_elem);
+	return hash_bytes(&f->inode, sizeof f->inode) ^ hash_int(f->ofs);
+}
+
+static bool frame_less(const struct hash_elem* a_, const struct hash_elem* b_,
+	void* aux UNUSED) {
+	const struct frame* a = hash_entry(a_, struct frame, hash_elem);
+	const struct frame* b = hash_entry(b_, struct frame, hash_elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* Initializes the frame table. */
+void frame_init(void) {
+	list_init(&frame_table);
+	hash_init(&shared_frames, frame_hash, frame_less, NULL);
+	lock_init(&frame_lock);
+}
+
+/* Releases the page locks of F's sharers before END. */
+static void unlock_sharers(struct frame* f, struct list_elem* end) {
+	struct list_elem* e;
+
+	for (e = list_begin(&f->sharers); e != end; e = list_next(e))
+		lock_release(&list_entry(e, struct sharer, elem)->page->lock);
+}
+
+/* Tries to lock the pages of all of shared frame F's sharers.
+   Returns false, with none of them locked, if one is busy. */
+static bool lock_sharers(struct frame* f) {
+	struct list_elem* e;
+
+	for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+		struct lock* page_lock = &list_entry(e, struct sharer, elem)->page->lock;
+		if (lock_held_by_current_thread(page_lock) || !lock_try_acquire(page_lock)) {
+			unlock_sharers(f, e);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Returns true if a sharer of F accessed it since the last call,
+   clearing their accessed bits. */
+static bool sharers_accessed(struct frame* f) {
+	struct list_elem* e;
+	bool accessed = false;
+
+	for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+		struct sharer* s = list_entry(e, struct sharer, elem);
+		if (pagedir_is_accessed(s->pagedir, s->page->upage)) {
+			pagedir_set_accessed(s->pagedir, s->page->upage, false);
+			accessed = true;
+		}
+	}
+	return accessed;
+}
+
+/* Unmaps shared frame F, whose sharers are locked, from all of
+   them and makes it private again.  The contents are clean, so
+   they are simply dropped and read again on the next fault. */
+static void unshare(struct frame* f) {
+	while (!list_empty(&f->sharers)) {
+		struct sharer* s = list_entry(list_pop_front(&f->sharers), struct sharer, elem);
+		pagedir_clear_page(s->pagedir, s->page->upage);
+		s->page->frame = NULL;
+		lock_release(&s->page->lock);
+		free(s);
+	}
+	hash_delete(&shared_frames, &f->hash_elem);
+	f->inode = NULL;
+	f->ref_cnt = 0;
+}
+
+/* Chooses a frame to evict with the second-chance clock: frames
+   whose page was accessed since the hand last passed get their
+   accessed bit cleared and are skipped once.  Pinned frames and
+   frames whose page is locked, by its owner faulting it or by
+   another eviction, are skipped.  Shared frames are unmapped from
+   all their sharers here.  Returns the victim pinned, with its
+   page locked if it was private, or a null pointer if two sweeps
+   find none.  Must be called with frame_lock held. */
+static struct frame* frame_pick_victim(void) {
+	size_t n = 2 * list_size(&frame_table);
+	size_t k;
+
+	for (k = 0; k < n; k++) {
+		struct frame* f = list_entry(list_pop_front(&frame_table), struct frame, elem);
+		struct lock* page_lock;
+
+		list_push_back(&frame_table, &f->elem);
+		if (f->pin_cnt > 0)
+			continue;
+		if (f->inode != NULL) {
+			if (!lock_sharers(f))
+				continue;
+			if (!sharers_accessed(f)) {
+				unshare(f);
+				f->pin_cnt = 1;
+				return f;
+			}
+			unlock_sharers(f, list_end(&f->sharers));
+			continue;
+		}
+
+		page_lock = &f->page->lock;
+		if (lock_held_by_current_thread(page_lock) || !lock_try_acquire(page_lock))
+			continue;
+		if (!pagedir_is_accessed(f->pagedir, f->page->upage)) {
+			f->pin_cnt = 1;
+			return f;
+		}
+		pagedir_set_accessed(f->pagedir, f->page->upage, false);
+		lock_release(page_lock);
+	}
+	return NULL;
+}
+
+/* Returns a frame for PAGE, to be mapped in PAGEDIR, evicting the
+   page of another frame if the user pool is exhausted.  The frame
+   is returned pinned; the caller unpins it once PAGE is mapped.
+   Returns a null pointer if no frame could be freed. */
+struct frame* frame_alloc(struct page* page, uint32_t* pagedir) {
+	struct frame* f;
+	void* kpage = palloc_get_page(PAL_USER);
+
+	if (kpage != NULL) {
+		f = malloc(sizeof * f);
+		if (f == NULL) {
+			palloc_free_page(kpage);
+			return NULL;
+		}
+		f->kpage = kpage;
+		f->page = page;
+		f->pagedir = pagedir;
+		f->pin_cnt = 1;
+		f->inode = NULL;
+		f->ref_cnt = 0;
+		list_init(&f->sharers);
+		lock_acquire(&frame_lock);
+		list_push_back(&frame_table, &f->elem);
+		lock_release(&frame_lock);
+		return f;
+	}
+
+	lock_acquire(&frame_lock);
+	f = frame_pick_victim();
+	lock_release(&frame_lock);
+	if (f == NULL)
+		return NULL;
+
+	/* A private victim stays pinned in the table while its page is
+	   written out, then passes to PAGE. */
+	if (f->page != NULL) {
+		bool evicted = page_evict(f->page, f->pagedir);
+		lock_release(&f->page->lock);
+		if (!evicted) {
+			frame_unpin(f);
+			return NULL;
+		}
+	}
+	f->page = page;
+	f->pagedir = pagedir;
+	return f;
+}
+
+/* Returns the shared frame already holding the contents of PAGE,
+   a read-only page of a file, after adding PAGE, to be mapped in
+   PAGEDIR, to its sharers.  The frame is returned pinned, as by
+   frame_alloc().  Returns a null pointer if no process has PAGE's
+   contents in a shared frame. */
+struct frame* frame_share(struct page* page, uint32_t* pagedir) {
+	struct frame key;
+	struct hash_elem* e;
+	struct frame* f = NULL;
+	struct sharer* s = malloc(sizeof * s);
+
+	if (s == NULL)
+		return NULL;
+	s->page = page;
+	s->pagedir = pagedir;
+
+	key.inode = file_get_inode(page->file);
+	key.ofs = page->ofs;
+	key.read_bytes = page->read_bytes;
+	lock_acquire(&frame_lock);
+	e = hash_find(&shared_frames, &key.hash_elem);
+	if (e != NULL) {
+		f = hash_entry(e, struct frame, hash_elem);
+		list_push_back(&f->sharers, &s->elem);
+		f->ref_cnt++;
+		f->pin_cnt++;
+	}
+	lock_release(&frame_lock);
+	if (f == NULL)
+		free(s);
+	return f;
+}
+
+/* Offers F, a private frame just filled with the contents of its
+   read-only file page, for sharing with other processes that map
+   the same part of the file.  F stays private if another process
+   published the same contents first. */
+void frame_publish(struct frame* f) {
+	struct sharer* s = malloc(sizeof * s);
+
+	if (s == NULL)
+		return;
+	s->page = f->page;
+	s->pagedir = f->pagedir;
+
+	lock_acquire(&frame_lock);
+	f->inode = file_get_inode(f->page->file);
+	f->ofs = f->page->ofs;
+	f->read_bytes = f->page->read_bytes;
+	if (hash_insert(&shared_frames, &f->hash_elem) == NULL) {
+		list_push_back(&f->sharers, &s->elem);
+		f->ref_cnt = 1;
+		f->page = NULL;
+		f->pagedir = NULL;
+		s = NULL;
+	}
+	else
+		f->inode = NULL;
+	lock_release(&frame_lock);
+	free(s);
+}
+
+/* Pins F, so that it is not evicted. */
+void frame_pin(struct frame* f) {
+	lock_acquire(&frame_lock);
+	f->pin_cnt++;
+	lock_release(&frame_lock);
+}
+
+/* Undoes one frame_pin(), or the pin a frame is returned with. */
+void frame_unpin(struct frame* f) {
+	lock_acquire(&frame_lock);
+	ASSERT(f->pin_cnt > 0);
+	f->pin_cnt--;
+	lock_release(&frame_lock);
+}
+
+/* Drops PAGE's use of F, which PAGE's owner has already unmapped.
+   F is freed if it was private or PAGE was its last sharer. */
+void frame_release(struct frame* f, struct page* page) {
+	bool last = true;
+
+	lock_acquire(&frame_lock);
+	if (f->inode != NULL) {
+		struct list_elem* e;
+
+		for (e = list_begin(&f->sharers); e != list_end(&f->sharers); e = list_next(e)) {
+			struct sharer* s = list_entry(e, struct sharer, elem);
+			if (s->page == page) {
+				list_remove(e);
+				free(s);
+				break;
+			}
+		}
+		last = --f->ref_cnt == 0;
+		if (last)
+			hash_delete(&shared_frames, &f->hash_elem);
+	}
+	if (last)
+		list_remove(&f->elem);
+	lock_release(&frame_lock);
+
+	if (last) {
+		palloc_free_page(f->kpage);
+		free(f);
+	}
+}
+
+/* Removes F, a private frame, from the frame table and frees it. */
+void frame_free(struct frame* f) {
+	lock_acquire(&frame_lock);
+	list_remove(&f->elem);
+	lock_release(&frame_lock);
+	palloc_free_page(f->kpage);
+	free(f);
+}
@@ -0,0 +1,41 @@
+#ifndef VM_FRAME_H
+#define VM_FRAME_H
+
+#include <hash.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct inode;
+struct page;
+
+/* A frame of the user pool holding a page of some process, or a
+   read-only file page shared by several processes. */
+struct frame
+{
+	void* kpage;                        /* Kernel virtual address. */
+	struct page* page;                  /* Page held, or NULL if shared. */
+	uint32_t* pagedir;                  /* Page directory mapping PAGE. */
+	unsigned pin_cnt;                   /* Not to be evicted while nonzero. */
+	struct list_elem elem;              /* Element in the frame table. */
+
+	/* Shared frames only. */
+	struct inode* inode;                /* File read into it, or NULL if private. */
+	off_t ofs;                          /* Offset in INODE. */
+	uint32_t read_bytes;                /* Bytes read, the rest is zeroed. */
+	size_t ref_cnt;                     /* Number of pages mapping it. */
+	struct list sharers;                /* Those pages, as struct sharer. */
+	struct hash_elem hash_elem;         /* Element in the shared frame table. */
+};
+
+void frame_init(void);
+struct frame* frame_alloc(struct page*, uint32_t* pagedir);
+struct frame* frame_share(struct page*, uint32_t* pagedir);
+void frame_publish(struct frame*);
+void frame_pin(struct frame*);
+void frame_unpin(struct frame*);
+void frame_release(struct frame*, struct page*);
+void frame_free(struct frame*);
+
+#endif /* vm/frame.h */
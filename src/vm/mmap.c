@@ -0,0 +1,109 @@
+#include "vm/mmap.h"
+#include <list.h>
+#include <round.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/page.h"
+
+/* A file mapped into a process's address space.  Its pages are
+   loaded on demand through the buffer cache, like executables,
+   and written back only if they were modified. */
+struct mapping
+{
+	int mapid;                          /* Identifier returned by mmap. */
+	struct file* file;                  /* Private handle on the file. */
+	void* base;                         /* First mapped page. */
+	size_t page_cnt;                    /* Number of mapped pages. */
+	struct list_elem elem;              /* Element in the thread's mappings. */
+};
+
+/* Removes the first PAGE_CNT pages of M, writing back the dirty
+   ones. */
+static void remove_pages(struct mapping* m, size_t page_cnt) {
+	size_t i;
+
+	for (i = 0; i < page_cnt; i++)
+		page_remove((uint8_t*)m->base + i * PGSIZE);
+}
+
+/* Maps FILE at the page-aligned user address ADDR in the current
+   process.  Returns the new mapping's identifier, or MAP_FAILED
+   if FILE is empty, ADDR is unsuitable or any page of the range
+   is already in use. */
+int mmap_map(struct file* file, void* addr) {
+	struct thread* t = thread_current();
+	struct mapping* m;
+	off_t length = file_length(file);
+	size_t i;
+
+	if (addr == NULL || pg_ofs(addr) != 0 || length == 0)
+		return MAP_FAILED;
+
+	m = malloc(sizeof *m);
+	if (m == NULL)
+		return MAP_FAILED;
+	m->base = addr;
+	m->page_cnt = DIV_ROUND_UP(length, PGSIZE);
+	for (i = 0; i < m->page_cnt; i++) {
+		void* upage = (uint8_t*)addr + i * PGSIZE;
+		if (!is_user_vaddr(upage) || page_lookup(upage) != NULL) {
+			free(m);
+			return MAP_FAILED;
+		}
+	}
+
+	/* Reopen FILE so that the mapping outlives the descriptor. */
+	m->file = file_reopen(file);
+	if (m->file == NULL) {
+		free(m);
+		return MAP_FAILED;
+	}
+	for (i = 0; i < m->page_cnt; i++) {
+		off_t ofs = i * PGSIZE;
+		uint32_t read_bytes = length - ofs < PGSIZE ? length - ofs : PGSIZE;
+		if (!page_add_mmap((uint8_t*)addr + ofs, m->file, ofs, read_bytes)) {
+			remove_pages(m, i);
+			file_close(m->file);
+			free(m);
+			return MAP_FAILED;
+		}
+	}
+
+	m->mapid = t->next_mapid++;
+	list_push_back(&t->mappings, &m->elem);
+	return m->mapid;
+}
+
+/* Unmaps M and frees it. */
+static void unmap(struct mapping* m) {
+	remove_pages(m, m->page_cnt);
+	list_remove(&m->elem);
+	file_close(m->file);
+	free(m);
+}
+
+/* Unmaps the current process's mapping MAPID.  Returns false if
+   there is no such mapping. */
+bool mmap_unmap(int mapid) {
+	struct list* mappings = &thread_current()->mappings;
+	struct list_elem* e;
+
+	for (e = list_begin(mappings); e != list_end(mappings); e = list_next(e)) {
+		struct mapping* m = list_entry(e, struct mapping, elem);
+		if (m->mapid == mapid) {
+			unmap(m);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Unmaps all of the current process's mappings, as on exit. */
+void mmap_unmap_all(void) {
+	struct list* mappings = &thread_current()->mappings;
+
+	while (!list_empty(mappings))
+		unmap(list_entry(list_front(mappings), struct mapping, elem));
+}
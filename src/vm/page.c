@@ -0,0 +1,383 @@
+#include "vm/page.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+
+/* Maximum number of pages in a process's stack.  The default
+   allows 8 MB; can be changed with the -stk kernel option. */
+size_t stack_page_limit = 2048;
+
+/* An access this far below the stack pointer is still taken as a
+   stack access, since PUSHA checks its lowest address (32 bytes
+   below esp) before it moves esp. */
+#define STACK_SLOP 32
+
+static unsigned page_hash(const struct hash_elem* e, void* aux UNUSED) {
+	const struct page* p = hash_entry(e, struct page, elem);
+	return hash_bytes(&p->upage, sizeof p->upage);
+}
+
+static bool page_less(const struct hash_elem* a, const struct hash_elem* b,
+	void* aux UNUSED) {
+	return hash_entry(a, struct page, elem)->upage
+		< hash_entry(b, struct page, elem)->upage;
+}
+
+/* Creates the current process's supplemental page table.
+   Returns false if memory allocation fails. */
+bool page_table_init(void) {
+	return hash_init(&thread_current()->pages, page_hash, page_less, NULL);
+}
+
+static void page_free(struct hash_elem* e, void* aux UNUSED) {
+	free(hash_entry(e, struct page, elem));
+}
+
+/* Destroys the current process's supplemental page table,
+   releasing the frames and swap slots of its pages and unmapping
+   them from PAGEDIR, which may be null if it was never created. */
+void page_table_destroy(uint32_t* pagedir) {
+	struct hash* pages = &thread_current()->pages;
+	struct hash_iterator i;
+
+	hash_first(&i, pages);
+	while (hash_next(&i)) {
+		struct page* p = hash_entry(hash_cur(&i), struct page, elem);
+
+		/* Wait out an eviction in progress. */
+		lock_acquire(&p->lock);
+		if (p->frame != NULL) {
+			pagedir_clear_page(pagedir, p->upage);
+			frame_release(p->frame, p);
+			p->frame = NULL;
+		}
+		else if (p->type == PAGE_SWAP)
+			swap_free(p->swap_slot);
+		lock_release(&p->lock);
+	}
+	hash_destroy(pages, page_free);
+}
+
+/* Allocates a page for UPAGE with no contents yet. */
+static struct page* page_create(void* upage, bool writable) {
+	struct page* p;
+
+	ASSERT(pg_ofs(upage) == 0);
+
+	p = malloc(sizeof * p);
+	if (p == NULL)
+		return NULL;
+	p->upage = upage;
+	p->writable = writable;
+	lock_init(&p->lock);
+	p->frame = NULL;
+	p->file = NULL;
+	p->ofs = 0;
+	p->read_bytes = 0;
+	return p;
+}
+
+/* Adds P to the current process's supplemental page table.
+   Frees P and returns false if its page is already there. */
+static bool page_add(struct page* p) {
+	if (hash_insert(&thread_current()->pages, &p->elem) != NULL) {
+		free(p);
+		return false;
+	}
+	return true;
+}
+
+/* Records that UPAGE is to be loaded on first access with
+   READ_BYTES bytes of FILE starting at OFS, followed by zeros.
+   Returns false if UPAGE is already recorded or memory
+   allocation fails. */
+bool page_add_file(void* upage, struct file* file, off_t ofs,
+	uint32_t read_bytes, bool writable) {
+	struct page* p;
+
+	ASSERT(read_bytes <= PGSIZE);
+
+	p = page_create(upage, writable);
+	if (p == NULL)
+		return false;
+	p->type = PAGE_FILE;
+	p->file = file;
+	p->ofs = ofs;
+	p->read_bytes = read_bytes;
+	return page_add(p);
+}
+
+/* Records that UPAGE is to be zero-filled on first access.
+   Returns false if UPAGE is already recorded or memory
+   allocation fails. */
+bool page_add_zero(void* upage, bool writable) {
+	struct page* p = page_create(upage, writable);
+
+	if (p == NULL)
+		return false;
+	p->type = PAGE_ZERO;
+	return page_add(p);
+}
+
+/* If an access to VADDR with the user stack pointer at ESP looks
+   like an access to the stack, records a new zero page at VADDR
+   as part of the stack and returns it.  Otherwise, or if the
+   stack would grow beyond stack_page_limit, returns a null
+   pointer. */
+static struct page* stack_add(const void* vaddr, const void* esp) {
+	uint8_t* upage = pg_round_down(vaddr);
+
+	if (!is_user_vaddr(vaddr) || (const uint8_t*)vaddr + STACK_SLOP < (const uint8_t*)esp)
+		return NULL;
+	if ((size_t)((uint8_t*)PHYS_BASE - upage) > stack_page_limit * PGSIZE)
+		return NULL;
+	if (!page_add_zero(upage, true))
+		return NULL;
+	return page_lookup(upage);
+}
+
+/* Records that UPAGE maps READ_BYTES bytes of FILE starting at
+   OFS, followed by zeros.  The page is writable, and changes are
+   written back to FILE when it is evicted or unmapped.  Returns
+   false if UPAGE is already recorded or memory allocation fails. */
+bool page_add_mmap(void* upage, struct file* file, off_t ofs,
+	uint32_t read_bytes) {
+	struct page* p;
+
+	ASSERT(read_bytes <= PGSIZE);
+
+	p = page_create(upage, true);
+	if (p == NULL)
+		return false;
+	p->type = PAGE_MMAP;
+	p->file = file;
+	p->ofs = ofs;
+	p->read_bytes = read_bytes;
+	return page_add(p);
+}
+
+/* Writes P, which is present in frame KPAGE, back to its file. */
+static void page_write_back(struct page* p, const void* kpage) {
+	file_write_at(p->file, kpage, p->read_bytes, p->ofs);
+}
+
+/* Removes the page at UPAGE from the current process, writing it
+   back to its file first if it is a dirty mapped page. */
+void page_remove(void* upage) {
+	struct thread* t = thread_current();
+	struct page* p = page_lookup(upage);
+
+	if (p == NULL)
+		return;
+	lock_acquire(&p->lock);
+	if (p->frame != NULL) {
+		if (p->type == PAGE_MMAP && pagedir_is_dirty(t->pagedir, p->upage))
+			page_write_back(p, p->frame->kpage);
+		pagedir_clear_page(t->pagedir, p->upage);
+		frame_release(p->frame, p);
+		p->frame = NULL;
+	}
+	else if (p->type == PAGE_SWAP)
+		swap_free(p->swap_slot);
+	lock_release(&p->lock);
+
+	hash_delete(&t->pages, &p->elem);
+	free(p);
+}
+
+/* Returns the current process's page containing VADDR, or a null
+   pointer if there is none. */
+struct page* page_lookup(const void* vaddr) {
+	struct page key;
+	struct hash_elem* e;
+
+	key.upage = pg_round_down(vaddr);
+	e = hash_find(&thread_current()->pages, &key.elem);
+	return e != NULL ? hash_entry(e, struct page, elem) : NULL;
+}
+
+/* Brings P, which the caller has locked, into a frame and maps
+   it.  Read-only file pages, such as program text, map the frame
+   of another process that already has the same contents, if any,
+   and otherwise offer theirs for sharing.  The frame is left
+   pinned. */
+static bool page_in(struct page* p) {
+	struct thread* t = thread_current();
+	bool shareable = p->type == PAGE_FILE && !p->writable;
+	struct frame* f;
+	uint8_t* kpage;
+
+	if (shareable) {
+		f = frame_share(p, t->pagedir);
+		if (f != NULL) {
+			if (!pagedir_set_page(t->pagedir, p->upage, f->kpage, false)) {
+				frame_unpin(f);
+				frame_release(f, p);
+				return false;
+			}
+			p->frame = f;
+			return true;
+		}
+	}
+
+	f = frame_alloc(p, t->pagedir);
+	if (f == NULL)
+		return false;
+	kpage = f->kpage;
+	switch (p->type) {
+	case PAGE_FILE:
+	case PAGE_MMAP:
+		if (file_read_at(p->file, kpage, p->read_bytes, p->ofs) != (off_t)p->read_bytes) {
+			frame_free(f);
+			return false;
+		}
+		memset(kpage + p->read_bytes, 0, PGSIZE - p->read_bytes);
+		break;
+	case PAGE_ZERO:
+		memset(kpage, 0, PGSIZE);
+		break;
+	case PAGE_SWAP:
+		swap_in(p->swap_slot, kpage);
+		break;
+	}
+
+	if (!pagedir_set_page(t->pagedir, p->upage, kpage, p->writable)) {
+		frame_free(f);
+		return false;
+	}
+	/* Only now that the page is mapped is its swap copy unneeded. */
+	if (p->type == PAGE_SWAP)
+		swap_free(p->swap_slot);
+	p->frame = f;
+	if (shareable)
+		frame_publish(f);
+	return true;
+}
+
+/* Brings the page containing FAULT_ADDR into a frame and maps it.
+   Returns false if the address is not part of the process's
+   address space, the page is already present, or memory or the
+   file read fails; the fault is then a real one. */
+bool page_load(const void* fault_addr) {
+	struct thread* t = thread_current();
+	struct page* p;
+	bool success;
+
+	if (t->pagedir == NULL)
+		return false;
+	p = page_lookup(fault_addr);
+	if (p == NULL)
+		return false;
+
+	lock_acquire(&p->lock);
+	success = p->frame == NULL && page_in(p);
+	if (success)
+		frame_unpin(p->frame);
+	lock_release(&p->lock);
+	return success;
+}
+
+/* Grows the current process's stack to cover FAULT_ADDR, if the
+   fault looks like a stack access with the user stack pointer at
+   ESP, and loads the new page.  Returns true if successful. */
+bool page_grow_stack(const void* fault_addr, const void* esp) {
+	return thread_current()->pagedir != NULL && stack_add(fault_addr, esp) != NULL
+		&& page_load(fault_addr);
+}
+
+/* Unmaps P, which the caller has locked, from its frame in
+   PAGEDIR so that the frame can be reused.  A dirty mapped page
+   is written back to its file.  Other contents that cannot be
+   read back from where they came from, because the page was
+   written or already came from swap, are written to swap.
+   Returns false, leaving P mapped, if swap is full. */
+bool page_evict(struct page* p, uint32_t* pagedir) {
+	/* Unmap first, so that the owner cannot write the page after
+	   its dirty bit has been read. */
+	pagedir_clear_page(pagedir, p->upage);
+	if (p->type == PAGE_MMAP) {
+		if (pagedir_is_dirty(pagedir, p->upage))
+			page_write_back(p, p->frame->kpage);
+	}
+	else if (p->type == PAGE_SWAP || pagedir_is_dirty(pagedir, p->upage)) {
+		size_t slot = swap_out(p->frame->kpage);
+		if (slot == SWAP_ERROR) {
+			pagedir_set_page(pagedir, p->upage, p->frame->kpage, p->writable);
+			pagedir_set_dirty(pagedir, p->upage, true);
+			return false;
+		}
+		p->type = PAGE_SWAP;
+		p->swap_slot = slot;
+	}
+	p->frame = NULL;
+	return true;
+}
+
+/* Brings in and pins every page of the user buffer of SIZE bytes
+   at BUFFER.  System calls do this before copying to or from the
+   buffer under file system locks, which a page fault that reads a
+   file could otherwise try to take again.  Returns false if part
+   of the buffer is not mapped, or is read-only and WRITE is true,
+   leaving none of it pinned. */
+bool page_pin(const void* buffer, size_t size, bool write) {
+	const uint8_t* upage;
+
+	if (size == 0)
+		return true;
+	for (upage = pg_round_down(buffer); upage < (const uint8_t*)buffer + size;
+		upage += PGSIZE) {
+		struct page* p = NULL;
+		bool success = false;
+
+		if (is_user_vaddr(upage)) {
+			p = page_lookup(upage);
+			if (p == NULL)
+				p = stack_add(upage < (const uint8_t*)buffer ? buffer : upage,
+					thread_current()->user_esp);
+		}
+		if (p != NULL && (!write || p->writable)) {
+			lock_acquire(&p->lock);
+			if (p->frame != NULL) {
+				frame_pin(p->frame);
+				success = true;
+			}
+			else
+				success = page_in(p);
+			lock_release(&p->lock);
+		}
+		if (!success) {
+			/* Pins are counted, and may be shared with other
+			   processes, so undo the ones taken so far. */
+			if (upage > (const uint8_t*)buffer)
+				page_unpin(buffer, upage - (const uint8_t*)buffer);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Unpins the pages of the user buffer of SIZE bytes at BUFFER. */
+void page_unpin(const void* buffer, size_t size) {
+	const uint8_t* upage;
+
+	if (size == 0)
+		return;
+	for (upage = pg_round_down(buffer); upage < (const uint8_t*)buffer + size;
+		upage += PGSIZE) {
+		struct page* p = page_lookup(upage);
+
+		if (p == NULL)
+			continue;
+		lock_acquire(&p->lock);
+		if (p->frame != NULL)
+			frame_unpin(p->frame);
+		lock_release(&p->lock);
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef VM_PAGE_H
+#define VM_PAGE_H
+
+#include <hash.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+#include "threads/synch.h"
+
+/* Where the contents of a page come from when it is faulted in. */
+enum page_type
+{
+	PAGE_FILE,                          /* Read from a file, rest zeroed. */
+	PAGE_ZERO,                          /* All zeros. */
+	PAGE_SWAP,                          /* Swap, or a frame when present. */
+	PAGE_MMAP                           /* A mapped file, written back when dirty. */
+};
+
+/* A page of a process's virtual address space, in its
+   supplemental page table.  Records what the page should hold
+   while it is not present in the page directory. */
+struct page
+{
+	void* upage;                        /* User virtual address. */
+	bool writable;                      /* May the process write it? */
+	struct lock lock;                   /* Held while loading or evicting. */
+	enum page_type type;                /* Source of the contents. */
+	struct frame* frame;                /* Frame holding it, or NULL. */
+
+	/* PAGE_FILE and PAGE_MMAP. */
+	struct file* file;                  /* File to read. */
+	off_t ofs;                          /* Offset in FILE. */
+	uint32_t read_bytes;                /* Bytes to read, the rest is zeroed. */
+
+	/* PAGE_SWAP. */
+	size_t swap_slot;                   /* Slot holding it while not present. */
+
+	struct hash_elem elem;              /* Element in the thread's pages. */
+};
+
+extern size_t stack_page_limit;
+
+bool page_table_init(void);
+void page_table_destroy(uint32_t* pagedir);
+bool page_add_file(void* upage, struct file*, off_t ofs,
+	uint32_t read_bytes, bool writable);
+bool page_add_zero(void* upage, bool writable);
+bool page_add_mmap(void* upage, struct file*, off_t ofs, uint32_t read_bytes);
+void page_remove(void* upage);
+struct page* page_lookup(const void* vaddr);
+bool page_load(const void* fault_addr);
+bool page_grow_stack(const void* fault_addr, const void* esp);
+bool page_evict(struct page*, uint32_t* pagedir);
+bool page_pin(const void* buffer, size_t size, bool write);
+void page_unpin(const void* buffer, size_t size);
+
+#endif /* vm/page.h */
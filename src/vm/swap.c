@@ -0,0 +1,63 @@
+#include "vm/swap.h"
+#include <bitmap.h>
+#include <debug.h>
+#include "devices/block.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Sectors per page-sized swap slot. */
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block* swap_device;   /* Swap device, or NULL if none. */
+static struct bitmap* swap_slots;   /* One bit per slot, true if in use. */
+static struct lock swap_lock;       /* Protects swap_slots. */
+
+/* Sets up swap on the BLOCK_SWAP device.  Without one, every
+   swap_out() fails. */
+void swap_init(void) {
+	size_t slot_cnt = 0;
+
+	swap_device = block_get_role(BLOCK_SWAP);
+	if (swap_device != NULL)
+		slot_cnt = block_size(swap_device) / SECTORS_PER_SLOT;
+	swap_slots = bitmap_create(slot_cnt);
+	if (swap_slots == NULL)
+		PANIC("swap: cannot allocate the slot bitmap");
+	lock_init(&swap_lock);
+}
+
+/* Writes the page at KPAGE to a free swap slot and returns the
+   slot, or SWAP_ERROR if swap is full. */
+size_t swap_out(const void* kpage) {
+	size_t slot, i;
+
+	lock_acquire(&swap_lock);
+	slot = bitmap_scan_and_flip(swap_slots, 0, 1, false);
+	lock_release(&swap_lock);
+	if (slot == BITMAP_ERROR)
+		return SWAP_ERROR;
+
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		block_write(swap_device, slot * SECTORS_PER_SLOT + i,
+			(const uint8_t*)kpage + i * BLOCK_SECTOR_SIZE);
+	return slot;
+}
+
+/* Reads swap slot SLOT into the page at KPAGE.  The slot stays
+   allocated until swap_free(), so that the caller can still fall
+   back on it if mapping the page fails. */
+void swap_in(size_t slot, void* kpage) {
+	size_t i;
+
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		block_read(swap_device, slot * SECTORS_PER_SLOT + i,
+			(uint8_t*)kpage + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Frees swap slot SLOT without reading it. */
+void swap_free(size_t slot) {
+	lock_acquire(&swap_lock);
+	ASSERT(bitmap_test(swap_slots, slot));
+	bitmap_reset(swap_slots, slot);
+	lock_release(&swap_lock);
+}